@@ -28,12 +28,77 @@
 #include <sys/types.h>
 #include <errno.h>
 
+struct access_profile;
+
+/* per-open file state, carried in fuse_file_info->fh */
+struct monfs_file {
+  int fd;
+  struct access_profile *ap; /* NULL if not monitored */
+};
+
+/* file system operations, for monfs_monitor_op() */
+enum monfs_op {
+  MONFS_OP_GETATTR,
+  MONFS_OP_READLINK,
+  MONFS_OP_MKNOD,
+  MONFS_OP_MKDIR,
+  MONFS_OP_UNLINK,
+  MONFS_OP_RMDIR,
+  MONFS_OP_SYMLINK,
+  MONFS_OP_RENAME,
+  MONFS_OP_LINK,
+  MONFS_OP_CHMOD,
+  MONFS_OP_CHOWN,
+  MONFS_OP_TRUNCATE,
+  MONFS_OP_OPEN,
+  MONFS_OP_READ,
+  MONFS_OP_WRITE,
+  MONFS_OP_STATFS,
+  MONFS_OP_FLUSH,
+  MONFS_OP_RELEASE,
+  MONFS_OP_FSYNC,
+  MONFS_OP_SETXATTR,
+  MONFS_OP_GETXATTR,
+  MONFS_OP_LISTXATTR,
+  MONFS_OP_REMOVEXATTR,
+  MONFS_OP_OPENDIR,
+  MONFS_OP_READDIR,
+  MONFS_OP_RELEASEDIR,
+  MONFS_OP_ACCESS,
+  MONFS_OP_CREATE,
+  MONFS_OP_FTRUNCATE,
+  MONFS_OP_FGETATTR,
+  MONFS_OP_LOCK,
+  MONFS_OP_UTIMENS,
+
+  MONFS_OPS
+};
+
+/* calls on an open file besides read and write, for monfs_monitor_sync() */
+enum monfs_sync {
+  MONFS_SYNC_FSYNC,
+  MONFS_SYNC_FDATASYNC,
+  MONFS_SYNC_FLUSH,
+  MONFS_SYNC_FTRUNCATE,
+
+  MONFS_SYNCS
+};
+
+int monfs_monitor_set_config(const char *, const char *);
+int monfs_monitor_read_config(const char *);
 int monfs_monitor_init(const char *);
 void monfs_monitor_destroy();
-int monfs_monitor_open(pid_t, uint64_t, const char *);
-int monfs_monitor_read(uint64_t, ssize_t, struct timeval *);
-int monfs_monitor_write(uint64_t, ssize_t, struct timeval *);
-int monfs_monitor_close(uint64_t, const char *);
+int monfs_monitor_open(pid_t, struct monfs_file *, const char *);
+int monfs_monitor_read(struct monfs_file *, size_t, ssize_t, off_t, unsigned long long);
+int monfs_monitor_write(struct monfs_file *, size_t, ssize_t, off_t, unsigned long long);
+int monfs_monitor_sync(struct monfs_file *, int, unsigned long long);
+int monfs_monitor_close(struct monfs_file *, const char *);
+struct monfs_file *monfs_monitor_file_alloc();
+void monfs_monitor_file_free(struct monfs_file *);
+void monfs_monitor_op(int, pid_t, unsigned long long, int);
+unsigned long long monfs_monitor_clock(); /* monotonic nsec, for timing I/O */
+int monfs_monitor_read_copy(); /* read monitored handles through monfs */
+int monfs_monitor_stats(char *, size_t); /* live statistics as text */
 
 enum monfs_errcode {
   MONFS_OK,
@@ -54,6 +119,7 @@ enum monfs_errcode {
   MONFS_ERR_APQ_WAIT,
   /* logger error */
   MONFS_ERR_LOGGER_INIT,
+  MONFS_ERR_LOGGER_WRITE,
   /* db error */
   MONFS_ERR_DB_INIT,
   MONFS_ERR_DB_OPEN,
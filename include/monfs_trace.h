@@ -0,0 +1,80 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef MONFS_TRACE_H_
+#define MONFS_TRACE_H_
+
+#include <stdint.h>
+
+/*
+ * Event trace file format.
+ *
+ * A MONFS_TRACE_HEADER_SIZE byte header is followed by a ring of
+ * fixed-size events, laid out in segments of MONFS_TRACE_SEGMENT_EVENTS
+ * events.  Event n lives in slot n % capacity, so once more than
+ * capacity events were written the oldest ones are overwritten and
+ * the trace starts at slot written % capacity.  Slots that were never
+ * filled have op 0.
+ */
+#define MONFS_TRACE_MAGIC "MONFSTRC"
+#define MONFS_TRACE_VERSION 1
+#define MONFS_TRACE_HEADER_SIZE 4096
+#define MONFS_TRACE_SEGMENT_EVENTS (1 << 18)
+
+struct monfs_trace_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t event_size;
+  uint64_t segment_events;
+  uint64_t capacity;		/* events in the ring */
+  uint64_t written;		/* events written so far */
+  int64_t realtime_offset;	/* time_ns + realtime_offset = nsec since the epoch */
+};
+
+enum monfs_trace_op {
+  MONFS_TRACE_NONE,
+  MONFS_TRACE_OPEN,
+  MONFS_TRACE_READ,
+  MONFS_TRACE_WRITE,
+  MONFS_TRACE_CLOSE,
+  MONFS_TRACE_FSYNC,
+  MONFS_TRACE_FDATASYNC,
+  MONFS_TRACE_FLUSH,
+  MONFS_TRACE_FTRUNCATE,
+
+  MONFS_TRACE_OPS
+};
+
+struct monfs_trace_event {
+  uint64_t time_ns;		/* monotonic, when the event was recorded */
+  uint64_t handle;		/* same for all events of an open file */
+  int64_t offset;
+  uint64_t latency_ns;		/* open to close for MONFS_TRACE_CLOSE */
+  uint32_t size;		/* bytes written since the last sync for
+				   MONFS_TRACE_FSYNC and MONFS_TRACE_FDATASYNC */
+  uint32_t tid;
+  uint32_t pid;			/* caller, for MONFS_TRACE_OPEN */
+  uint16_t op;
+  uint16_t reserved;
+};
+
+#endif /* MONFS_TRACE_H_ */
@@ -23,112 +23,369 @@
 #include <stdlib.h>
 #include <string.h>
 #include <monfs.h>
+#include "access_profile.h"
+#include "pool.h"
+#include "strtab.h"
+#include "clock.h"
+#include "hist.h"
+
+static struct pool *ap_pool = NULL;
+static struct pool *hist_pool = NULL;
 
 /*
  * I/O Profile
+ *
+ * Updated with atomic adds, since threads sharing a file handle may
+ * read or write it concurrently.  The latency histogram is only
+ * allocated on the first operation; the request size counts live
+ * inline.
  */
 struct io_profile {
   unsigned long long size;
-  struct timeval time;
+  unsigned long long nsec;
+  unsigned long long ops;
+  unsigned long long unaligned_4k;
+  unsigned long long unaligned_blk;
+  uint32_t sizes[AP_SIZE_BUCKETS];
+  struct hist *hist;
+
+  /* access pattern */
+  long long last_off, last_end, last_delta;
+  unsigned long long pattern[AP_PATTERNS];
+  long long stride;		/* last stride seen */
+  unsigned long long seek;	/* bytes skipped by non-sequential requests */
 };
 
 static void
 iop_clear(struct io_profile *iop)
 {
   iop->size = 0ULL;
-  timerclear(&(iop->time));
+  iop->nsec = 0ULL;
+  iop->ops = 0ULL;
+  iop->unaligned_4k = 0ULL;
+  iop->unaligned_blk = 0ULL;
+  memset(iop->sizes, 0, sizeof(iop->sizes));
+  iop->hist = NULL;
+  iop->last_off = iop->last_end = iop->last_delta = 0LL;
+  memset(iop->pattern, 0, sizeof(iop->pattern));
+  iop->stride = 0LL;
+  iop->seek = 0ULL;
+}
+
+/* bucket 0 counts empty requests, bucket i sizes in [2^(i-1), 2^i) */
+static int
+size_bucket(unsigned long long size)
+{
+  int i;
+
+  if (size == 0)
+    return 0;
+
+  i = 64 - __builtin_clzll(size);
+  return i < AP_SIZE_BUCKETS ? i : AP_SIZE_BUCKETS - 1;
+}
+
+static int
+is_unaligned(off_t offset, unsigned long long size, unsigned long align)
+{
+  if ((align & (align - 1)) == 0)
+    return (((unsigned long long)offset | size) & (align - 1)) != 0;
+
+  return (unsigned long long)offset % align != 0 || size % align != 0;
+}
+
+/*
+ * Classify a request against the previous one: sequential if it starts
+ * where the last one ended, backward if it starts before the last one
+ * did, which takes in a file read back to front, strided if it moved
+ * forward by the same distance as the last one did, otherwise backward
+ * or random (forward) by where it lands relative to the last end.
+ *
+ * Requests racing on a shared handle only swap whole words, so the
+ * worst case is a misclassified request.
+ */
+static void
+iop_update_pattern(struct io_profile *iop, long long off, long long size)
+{
+  long long prev_off, prev_end, prev_delta, delta;
+  int pattern;
+
+  prev_end = __atomic_exchange_n(&(iop->last_end), off + size, __ATOMIC_RELAXED);
+  prev_off = __atomic_exchange_n(&(iop->last_off), off, __ATOMIC_RELAXED);
+  delta = off - prev_off;
+  prev_delta = __atomic_exchange_n(&(iop->last_delta), delta, __ATOMIC_RELAXED);
+
+  if (off == prev_end) {
+    pattern = AP_SEQUENTIAL;
+  } else {
+    if (delta < 0) {
+      pattern = AP_BACKWARD;
+    } else if (delta > 0 && delta == prev_delta) {
+      pattern = AP_STRIDED;
+      __atomic_store_n(&(iop->stride), delta, __ATOMIC_RELAXED);
+    } else if (off < prev_end) {
+      pattern = AP_BACKWARD;
+    } else {
+      pattern = AP_RANDOM;
+    }
+    __atomic_add_fetch(&(iop->seek),
+		       off > prev_end ? off - prev_end : prev_end - off,
+		       __ATOMIC_RELAXED);
+  }
+
+  __atomic_add_fetch(&(iop->pattern[pattern]), 1, __ATOMIC_RELAXED);
+}
+
+static struct hist *
+iop_get_hist(struct io_profile *iop)
+{
+  struct hist *h, *old = NULL;
+
+  h = __atomic_load_n(&(iop->hist), __ATOMIC_ACQUIRE);
+  if (h != NULL)
+    return h;
+
+  h = pool_get(hist_pool);
+  if (h == NULL)
+    return NULL;
+  hist_clear(h);
+
+  if (!__atomic_compare_exchange_n(&(iop->hist), &old, h, 0,
+				   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    pool_put(h);
+    return old;
+  }
+
+  return h;
 }
 
+/*
+ * size is what the request asked for, which is what its size bucket and
+ * alignment describe; bytes is what it transferred, short at the end of
+ * the file.
+ */
 static void
-iop_update(struct io_profile *iop, ssize_t size, struct timeval *time)
+iop_update(struct io_profile *iop, size_t size, ssize_t bytes, off_t offset,
+	   unsigned long long nsec, unsigned long blksize)
+{
+  struct hist *h;
+
+  __atomic_add_fetch(&(iop->size), (unsigned long long) bytes, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&(iop->nsec), nsec, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&(iop->ops), 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&(iop->sizes[size_bucket(size)]), 1, __ATOMIC_RELAXED);
+  if (is_unaligned(offset, size, 4096))
+    __atomic_add_fetch(&(iop->unaligned_4k), 1, __ATOMIC_RELAXED);
+  if (is_unaligned(offset, size, blksize))
+    __atomic_add_fetch(&(iop->unaligned_blk), 1, __ATOMIC_RELAXED);
+  iop_update_pattern(iop, offset, size);
+
+  h = iop_get_hist(iop);
+  if (h != NULL)
+    hist_record(h, nsec);
+}
+
+/* add src to dst; both are private to the caller by now */
+static void
+iop_merge(struct io_profile *dst, const struct io_profile *src)
+{
+  struct hist *h;
+  int i;
+
+  dst->size += src->size;
+  dst->nsec += src->nsec;
+  dst->ops += src->ops;
+  dst->unaligned_4k += src->unaligned_4k;
+  dst->unaligned_blk += src->unaligned_blk;
+  for (i = 0; i < AP_SIZE_BUCKETS; i++)
+    dst->sizes[i] += src->sizes[i];
+  for (i = 0; i < AP_PATTERNS; i++)
+    dst->pattern[i] += src->pattern[i];
+  if (src->stride != 0)
+    dst->stride = src->stride;
+  dst->seek += src->seek;
+
+  if (src->hist != NULL) {
+    h = iop_get_hist(dst);
+    if (h != NULL)
+      hist_merge(h, src->hist);
+  }
+}
+
+static void
+iop_free(struct io_profile *iop)
+{
+  if (iop->hist != NULL)
+    pool_put(iop->hist);
+  iop->hist = NULL;
+}
+
+/* store v in *p if it is larger, racing updates keep the largest */
+static void
+update_max(unsigned long long *p, unsigned long long v)
+{
+  unsigned long long max;
+
+  max = __atomic_load_n(p, __ATOMIC_RELAXED);
+  while (v > max &&
+	 !__atomic_compare_exchange_n(p, &max, v, 1,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/*
+ * Sync Profile
+ *
+ * Calls on a handle that neither read nor write but cost time: fsync,
+ * fdatasync, flush and ftruncate, counted on success like reads and
+ * writes are.
+ */
+struct sync_profile {
+  unsigned long long ops;
+  unsigned long long nsec;
+  unsigned long long max_nsec;
+};
+
+static const char *sync_names[] = {
+  [MONFS_SYNC_FSYNC] = "fsync",
+  [MONFS_SYNC_FDATASYNC] = "fdatasync",
+  [MONFS_SYNC_FLUSH] = "flush",
+  [MONFS_SYNC_FTRUNCATE] = "ftruncate",
+};
+
+const char *
+ap_sync_name(int kind)
 {
-  iop->size += (unsigned long long) size;
-  timeradd(&(iop->time), time, &(iop->time));
+  return sync_names[kind];
 }
 
 /*
  * Access Profile
  */
 struct access_profile {
-  char *path;
+  unsigned long handles; /* > 1 for a summary, see ap_merge() */
+  const char *path;
   pid_t pid;
-  char *caller_path;
-  struct timeval open, close;
+  const char *caller_path;
+  unsigned long long open_time, close_time; /* nsec since the epoch */
+  unsigned long long open_clock, duration; /* monotonic nsec */
+  unsigned long blksize; /* of the backing file */
   struct io_profile read, write;
-  char *hostname;
+  struct sync_profile sync[MONFS_SYNCS];
+  /* bytes written since the last fsync or fdatasync */
+  unsigned long long unsynced;
+  /* the same, taken at each fsync or fdatasync */
+  unsigned long long synced, synced_max;
+  uint32_t synced_sizes[AP_SIZE_BUCKETS];
+  const char *hostname;
 };
 
 static void
 ap_clear(struct access_profile *ap)
 {
+  ap->handles = 1;
   ap->path = NULL;
   ap->pid = 0;
   ap->caller_path = NULL;
-  timerclear(&(ap->open));
+  ap->open_time = ap->close_time = 0ULL;
+  ap->open_clock = ap->duration = 0ULL;
+  ap->blksize = 4096;
   iop_clear(&(ap->read));
   iop_clear(&(ap->write));
+  memset(ap->sync, 0, sizeof(ap->sync));
+  ap->unsynced = ap->synced = ap->synced_max = 0ULL;
+  memset(ap->synced_sizes, 0, sizeof(ap->synced_sizes));
   ap->hostname = NULL;
 }
 
+/*
+ * The string setters take over a reference to an interned string
+ * (str_intern()/str_ref()), which ap_free() releases.
+ */
 void
 ap_set_path(struct access_profile *ap, const char *path)
 {
-  if (path == NULL)
-    ap->path = strdup("");
-  else
-    ap->path = strdup(path);
+  ap->path = path;
 }
 
 void
 ap_set_caller(struct access_profile *ap, pid_t pid, const char *caller_path)
 {
   ap->pid = pid;
-  ap->caller_path = strdup(caller_path);
+  ap->caller_path = caller_path;
 }
 
 void
 ap_set_open(struct access_profile *ap)
 {
-  gettimeofday(&(ap->open), NULL);
+  ap->open_time = monfs_clock_realtime_ns();
+  ap->open_clock = monfs_clock_ns();
 }
 
 void
 ap_set_close(struct access_profile *ap)
 {
-  gettimeofday(&(ap->close), NULL);
+  ap->close_time = monfs_clock_realtime_ns();
+  ap->duration = monfs_clock_ns() - ap->open_clock;
 }
 
 void
-ap_update_read(struct access_profile *ap, ssize_t size, struct timeval *time)
+ap_set_blksize(struct access_profile *ap, unsigned long blksize)
 {
-  iop_update(&(ap->read), size, time);
+  if (blksize > 0)
+    ap->blksize = blksize;
 }
 
 void
-ap_update_write(struct access_profile *ap, ssize_t size, struct timeval *time)
+ap_update_read(struct access_profile *ap, size_t size, ssize_t bytes,
+	       off_t offset, unsigned long long nsec)
 {
-  iop_update(&(ap->write), size, time);
+  iop_update(&(ap->read), size, bytes, offset, nsec, ap->blksize);
 }
 
 void
-ap_set_hostname(struct access_profile *ap, const char *hostname)
+ap_update_write(struct access_profile *ap, size_t size, ssize_t bytes,
+		off_t offset, unsigned long long nsec)
 {
-  ap->hostname = strdup(hostname);
+  iop_update(&(ap->write), size, bytes, offset, nsec, ap->blksize);
+  __atomic_add_fetch(&(ap->unsynced), (unsigned long long) bytes,
+		     __ATOMIC_RELAXED);
 }
 
-static unsigned long
-get_sec(const struct timeval *t)
+/*
+ * Account a sync call of kind (MONFS_SYNC_*).  fsync and fdatasync
+ * also take the bytes written since the previous one, which are
+ * returned.
+ */
+unsigned long long
+ap_update_sync(struct access_profile *ap, int kind, unsigned long long nsec)
 {
-  return (unsigned long)(t->tv_sec);
+  struct sync_profile *sp = &(ap->sync[kind]);
+  unsigned long long bytes;
+
+  __atomic_add_fetch(&(sp->ops), 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&(sp->nsec), nsec, __ATOMIC_RELAXED);
+  update_max(&(sp->max_nsec), nsec);
+
+  if (kind != MONFS_SYNC_FSYNC && kind != MONFS_SYNC_FDATASYNC)
+    return 0;
+
+  bytes = __atomic_exchange_n(&(ap->unsynced), 0, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&(ap->synced), bytes, __ATOMIC_RELAXED);
+  update_max(&(ap->synced_max), bytes);
+  __atomic_add_fetch(&(ap->synced_sizes[size_bucket(bytes)]), 1,
+		     __ATOMIC_RELAXED);
+
+  return bytes;
 }
 
-static unsigned long
-get_usec(const struct timeval *t)
+void
+ap_set_hostname(struct access_profile *ap, const char *hostname)
 {
-  return (unsigned long)(t->tv_usec);
+  ap->hostname = hostname;
 }
 
-char *
+const char *
 ap_get_path(struct access_profile *ap)
 {
   return ap->path;
@@ -140,16 +397,28 @@ ap_get_pid(struct access_profile *ap)
   return ap->pid;
 }
 
-char *
+const char *
 ap_get_caller_path(struct access_profile *ap)
 {
   return ap->caller_path;
 }
 
-unsigned long
-ap_get_time_stamp(struct access_profile *ap)
+unsigned long long
+ap_get_open_time(struct access_profile *ap)
+{
+  return ap->open_time;
+}
+
+unsigned long long
+ap_get_close_time(struct access_profile *ap)
+{
+  return ap->close_time;
+}
+
+unsigned long long
+ap_get_duration(struct access_profile *ap)
 {
-  return get_sec(&(ap->open));
+  return ap->duration;
 }
 
 unsigned long long
@@ -158,16 +427,64 @@ ap_get_r_size(struct access_profile *ap)
   return ap->read.size;
 }
 
-unsigned long
-ap_get_r_sec(struct access_profile *ap)
+unsigned long long
+ap_get_r_nsec(struct access_profile *ap)
 {
-  return get_sec(&(ap->read.time));
+  return ap->read.nsec;
 }
 
 unsigned long
-ap_get_r_usec(struct access_profile *ap)
+ap_get_blksize(struct access_profile *ap)
+{
+  return ap->blksize;
+}
+
+unsigned long long
+ap_get_r_ops(struct access_profile *ap)
+{
+  return ap->read.ops;
+}
+
+unsigned long long
+ap_get_r_unaligned_4k(struct access_profile *ap)
+{
+  return ap->read.unaligned_4k;
+}
+
+unsigned long long
+ap_get_r_unaligned_blk(struct access_profile *ap)
+{
+  return ap->read.unaligned_blk;
+}
+
+const uint32_t *
+ap_get_r_sizes(struct access_profile *ap)
+{
+  return ap->read.sizes;
+}
+
+unsigned long long
+ap_get_r_pattern(struct access_profile *ap, int pattern)
+{
+  return ap->read.pattern[pattern];
+}
+
+long long
+ap_get_r_stride(struct access_profile *ap)
 {
-  return get_usec(&(ap->read.time));
+  return ap->read.stride;
+}
+
+unsigned long long
+ap_get_r_seek(struct access_profile *ap)
+{
+  return ap->read.seek;
+}
+
+const struct hist *
+ap_get_r_hist(struct access_profile *ap)
+{
+  return ap->read.hist;
 }
 
 unsigned long long
@@ -176,30 +493,202 @@ ap_get_w_size(struct access_profile *ap)
   return ap->write.size;
 }
 
-unsigned long
-ap_get_w_sec(struct access_profile *ap)
+unsigned long long
+ap_get_w_nsec(struct access_profile *ap)
+{
+  return ap->write.nsec;
+}
+
+unsigned long long
+ap_get_w_ops(struct access_profile *ap)
+{
+  return ap->write.ops;
+}
+
+unsigned long long
+ap_get_w_unaligned_4k(struct access_profile *ap)
+{
+  return ap->write.unaligned_4k;
+}
+
+unsigned long long
+ap_get_w_unaligned_blk(struct access_profile *ap)
+{
+  return ap->write.unaligned_blk;
+}
+
+const uint32_t *
+ap_get_w_sizes(struct access_profile *ap)
+{
+  return ap->write.sizes;
+}
+
+unsigned long long
+ap_get_w_pattern(struct access_profile *ap, int pattern)
+{
+  return ap->write.pattern[pattern];
+}
+
+long long
+ap_get_w_stride(struct access_profile *ap)
+{
+  return ap->write.stride;
+}
+
+unsigned long long
+ap_get_w_seek(struct access_profile *ap)
+{
+  return ap->write.seek;
+}
+
+const struct hist *
+ap_get_w_hist(struct access_profile *ap)
+{
+  return ap->write.hist;
+}
+
+unsigned long long
+ap_get_sync_ops(struct access_profile *ap, int kind)
+{
+  return ap->sync[kind].ops;
+}
+
+unsigned long long
+ap_get_sync_nsec(struct access_profile *ap, int kind)
+{
+  return ap->sync[kind].nsec;
+}
+
+unsigned long long
+ap_get_sync_max(struct access_profile *ap, int kind)
 {
-  return get_sec(&(ap->write.time));
+  return ap->sync[kind].max_nsec;
+}
+
+unsigned long long
+ap_get_synced(struct access_profile *ap)
+{
+  return ap->synced;
+}
+
+unsigned long long
+ap_get_synced_max(struct access_profile *ap)
+{
+  return ap->synced_max;
+}
+
+const uint32_t *
+ap_get_synced_sizes(struct access_profile *ap)
+{
+  return ap->synced_sizes;
+}
+
+unsigned long long
+ap_get_unsynced(struct access_profile *ap)
+{
+  return ap->unsynced;
 }
 
 unsigned long
-ap_get_w_usec(struct access_profile *ap)
+ap_get_handles(struct access_profile *ap)
 {
-  return get_usec(&(ap->write.time));
+  return ap->handles;
 }
 
-char *
+const char *
 ap_get_hostname(struct access_profile *ap)
 {
   return ap->hostname;
 }
 
+/*
+ * Fold the closed profile src into dst, a summary of earlier handles of
+ * the same path: counts add up, the open and close times widen to cover
+ * both, and the caller is dropped once handles of different pids meet.
+ */
+void
+ap_merge(struct access_profile *dst, const struct access_profile *src)
+{
+  int i;
+
+  dst->handles += src->handles;
+  if (src->open_time < dst->open_time)
+    dst->open_time = src->open_time;
+  if (src->close_time > dst->close_time)
+    dst->close_time = src->close_time;
+  dst->duration += src->duration;
+  if (dst->pid != src->pid && dst->pid != 0) {
+    dst->pid = 0;
+    str_release(dst->caller_path);
+    dst->caller_path = NULL;
+  }
+
+  iop_merge(&(dst->read), &(src->read));
+  iop_merge(&(dst->write), &(src->write));
+  for (i = 0; i < MONFS_SYNCS; i++) {
+    dst->sync[i].ops += src->sync[i].ops;
+    dst->sync[i].nsec += src->sync[i].nsec;
+    if (src->sync[i].max_nsec > dst->sync[i].max_nsec)
+      dst->sync[i].max_nsec = src->sync[i].max_nsec;
+  }
+  dst->unsynced += src->unsynced;
+  dst->synced += src->synced;
+  if (src->synced_max > dst->synced_max)
+    dst->synced_max = src->synced_max;
+  for (i = 0; i < AP_SIZE_BUCKETS; i++)
+    dst->synced_sizes[i] += src->synced_sizes[i];
+}
+
+/* what a profile may hold at most, histograms included */
+size_t
+ap_memory_size()
+{
+  return sizeof(struct access_profile) + 2 * sizeof(struct hist);
+}
+
+/*
+ * Profiles and their histograms are allocated on FUSE threads and freed
+ * on the logger thread, so they come from per-thread pools rather than
+ * malloc.
+ */
+int
+ap_pool_init()
+{
+  ap_pool = pool_create(sizeof(struct access_profile));
+  if (ap_pool == NULL)
+    return MONFS_ERR_NO_MEMORY;
+
+  hist_pool = pool_create(sizeof(struct hist));
+  if (hist_pool == NULL) {
+    pool_destroy(ap_pool);
+    ap_pool = NULL;
+    return MONFS_ERR_NO_MEMORY;
+  }
+
+  return MONFS_OK;
+}
+
+void
+ap_pool_destroy()
+{
+  pool_destroy(hist_pool);
+  hist_pool = NULL;
+  pool_destroy(ap_pool);
+  ap_pool = NULL;
+}
+
+void
+ap_pool_get_stats(struct pool_stats *stats)
+{
+  pool_get_stats(ap_pool, stats);
+}
+
 int
 ap_alloc(struct access_profile **app)
 {
   struct access_profile *ap;
 
-  ap = malloc(sizeof(*ap));
+  ap = pool_get(ap_pool);
   if (ap == NULL) {
     *app = NULL;
     return MONFS_ERR_NO_MEMORY;
@@ -220,14 +709,11 @@ ap_free(void *args)
   if (ap == NULL)
     return;
 
-  if (ap->path != NULL)
-    free(ap->path);
-
-  if (ap->caller_path != NULL)
-    free(ap->caller_path);
-
-  if (ap->hostname != NULL)
-    free(ap->hostname);
+  str_release(ap->path);
+  str_release(ap->caller_path);
+  str_release(ap->hostname);
+  iop_free(&(ap->read));
+  iop_free(&(ap->write));
 
-  free(ap);
+  pool_put(ap);
 }
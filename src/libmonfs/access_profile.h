@@ -23,29 +23,78 @@
 #ifndef ACCESS_PROFILE_H_
 #define ACCESS_PROFILE_H_
 
+#include <stdint.h>
+
+/* request sizes by power of two, see size_bucket() */
+#define AP_SIZE_BUCKETS 32
+
+/* access patterns, see iop_update_pattern() */
+enum {
+  AP_SEQUENTIAL,
+  AP_STRIDED,
+  AP_BACKWARD,
+  AP_RANDOM,
+  AP_PATTERNS
+};
+
 struct access_profile;
+struct pool_stats;
+struct hist;
 
 void ap_set_path(struct access_profile *, const char *);
 void ap_set_caller(struct access_profile *, pid_t, const char *);
 void ap_set_open(struct access_profile *);
 void ap_set_close(struct access_profile *);
-void ap_update_read(struct access_profile *, ssize_t, struct timeval *);
-void ap_update_write(struct access_profile *, ssize_t, struct timeval *);
+void ap_set_blksize(struct access_profile *, unsigned long);
+void ap_update_read(struct access_profile *, size_t, ssize_t, off_t, unsigned long long);
+void ap_update_write(struct access_profile *, size_t, ssize_t, off_t, unsigned long long);
+unsigned long long ap_update_sync(struct access_profile *, int, unsigned long long);
 void ap_set_hostname(struct access_profile *, const char *);
+void ap_merge(struct access_profile *, const struct access_profile *);
 
-char * ap_get_path(struct access_profile *);
+const char * ap_get_path(struct access_profile *);
 pid_t ap_get_pid(struct access_profile *);
-char * ap_get_caller_path(struct access_profile *);
-unsigned long ap_get_time_stamp(struct access_profile *);
+const char * ap_get_caller_path(struct access_profile *);
+unsigned long long ap_get_open_time(struct access_profile *);
+unsigned long long ap_get_close_time(struct access_profile *);
+unsigned long long ap_get_duration(struct access_profile *);
+unsigned long ap_get_blksize(struct access_profile *);
 unsigned long long ap_get_r_size(struct access_profile *);
-unsigned long ap_get_r_sec(struct access_profile *);
-unsigned long ap_get_r_usec(struct access_profile *);
+unsigned long long ap_get_r_nsec(struct access_profile *);
+unsigned long long ap_get_r_ops(struct access_profile *);
+unsigned long long ap_get_r_unaligned_4k(struct access_profile *);
+unsigned long long ap_get_r_unaligned_blk(struct access_profile *);
+const uint32_t * ap_get_r_sizes(struct access_profile *);
+unsigned long long ap_get_r_pattern(struct access_profile *, int);
+long long ap_get_r_stride(struct access_profile *);
+unsigned long long ap_get_r_seek(struct access_profile *);
+const struct hist * ap_get_r_hist(struct access_profile *);
 unsigned long long ap_get_w_size(struct access_profile *);
-unsigned long ap_get_w_sec(struct access_profile *);
-unsigned long ap_get_w_usec(struct access_profile *);
-char * ap_get_hostname(struct access_profile *);
+unsigned long long ap_get_w_nsec(struct access_profile *);
+unsigned long long ap_get_w_ops(struct access_profile *);
+unsigned long long ap_get_w_unaligned_4k(struct access_profile *);
+unsigned long long ap_get_w_unaligned_blk(struct access_profile *);
+const uint32_t * ap_get_w_sizes(struct access_profile *);
+unsigned long long ap_get_w_pattern(struct access_profile *, int);
+long long ap_get_w_stride(struct access_profile *);
+unsigned long long ap_get_w_seek(struct access_profile *);
+const struct hist * ap_get_w_hist(struct access_profile *);
+unsigned long long ap_get_sync_ops(struct access_profile *, int);
+unsigned long long ap_get_sync_nsec(struct access_profile *, int);
+unsigned long long ap_get_sync_max(struct access_profile *, int);
+unsigned long long ap_get_synced(struct access_profile *);
+unsigned long long ap_get_synced_max(struct access_profile *);
+const uint32_t * ap_get_synced_sizes(struct access_profile *);
+unsigned long long ap_get_unsynced(struct access_profile *);
+unsigned long ap_get_handles(struct access_profile *);
+const char * ap_get_hostname(struct access_profile *);
+const char * ap_sync_name(int);
 
+int ap_pool_init();
+void ap_pool_destroy();
+void ap_pool_get_stats(struct pool_stats *);
 int ap_alloc(struct access_profile **);
 void ap_free(void *);
+size_t ap_memory_size();
 
 #endif /* ACCESS_PROFILE_H_ */
@@ -20,12 +20,85 @@
  * See the file COPYING.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include <monfs.h>
 #include "access_profile.h"
+#include "access_profile_queue.h"
+#include "config.h"
 #include "queue.h"
+#include "hash.h"
+#include "counter.h"
+#include "clock.h"
+#include "error.h"
+
+/*
+ * What a closer does when the logger falls behind and the queue is full
+ * (queue_overflow): wait for a free slot, drop its profile, or fold it
+ * into a per path summary that the logger writes once it catches up.
+ */
+enum {
+  APQ_BLOCK,
+  APQ_DROP,
+  APQ_FOLD
+};
+
+#define APQ_SAMPLE_MAX_SHIFT 10	/* keep at least 1 in 1024 */
+#define APQ_SAMPLE_PERIOD 1000000000ULL	/* nsec between rate changes */
 
 static struct queue *apq = NULL;
+static int overflow = APQ_DROP;
+static int overflow_reported = 0;
+
+/*
+ * Summaries of folded profiles, by interned path.  At most a quarter
+ * as many as the queue has slots; beyond that profiles are dropped.
+ */
+static pthread_mutex_t fold_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hash_table *fold_table = NULL;
+static struct access_profile **fold_list = NULL;
+static unsigned long nfolded = 0, fold_max = 0;
+
+/*
+ * With queue_sampling, only 1 in 2^sample_shift closed profiles is
+ * queued while the queue stays deep; the others are folded or dropped.
+ */
+static unsigned int sample_shift = 0;
+static __thread unsigned long sample_seq = 0;
+static unsigned long long sample_changed = 0; /* logger thread only */
+
+static int
+parse_overflow(const char *policy)
+{
+  if (strcmp(policy, "block") == 0)
+    return APQ_BLOCK;
+  if (strcmp(policy, "drop") == 0)
+    return APQ_DROP;
+  if (strcmp(policy, "fold") == 0)
+    return APQ_FOLD;
+  return -1;
+}
+
+/* queue_size, cut down to a power of two that fits in queue_memory */
+static unsigned long
+queue_slots()
+{
+  unsigned long size, max, n;
+
+  size = monfs_config_get_queue_size();
+  if (monfs_config_get_queue_memory() > 0) {
+    max = ((unsigned long)monfs_config_get_queue_memory() << 20) /
+      ap_memory_size();
+    for (n = 2; n * 2 <= max; n <<= 1)
+      ;
+    if (size > n)
+      size = n;
+  }
+
+  return size;
+}
 
 int
 apq_init()
@@ -33,9 +106,27 @@ apq_init()
   if (apq != NULL)
     return MONFS_ERR_APQ_INIT;
 
-  if (queue_alloc(&apq) != 0)
+  overflow = parse_overflow(monfs_config_get_queue_overflow());
+  if (overflow < 0) {
+    monfs_err_msg(MONFS_ERR_CONF_PARSE, monfs_config_get_queue_overflow());
+    return MONFS_ERR_APQ_INIT;
+  }
+  overflow_reported = 0;
+  sample_shift = 0;
+
+  if (queue_alloc(&apq, queue_slots()) != 0)
     return MONFS_ERR_APQ_ALLOC;
 
+  if (overflow == APQ_FOLD) {
+    fold_max = queue_capacity(apq) / 4;
+    fold_table = hash_table_alloc(1024, hash_default, hash_key_equal_default);
+    fold_list = malloc(sizeof(struct access_profile *) * fold_max);
+    if (fold_table == NULL || fold_list == NULL) {
+      apq_destroy();
+      return MONFS_ERR_APQ_ALLOC;
+    }
+  }
+
   return MONFS_OK;
 }
 
@@ -43,35 +134,222 @@ void
 apq_destroy()
 {
   queue_free(apq, ap_free);
+  apq = NULL;
+
+  while (nfolded > 0)
+    ap_free(fold_list[--nfolded]);
+  free(fold_list);
+  fold_list = NULL;
+  hash_table_free(fold_table);
+  fold_table = NULL;
+}
+
+/* add ap to the summary of its path; returns 0 if there is no room */
+static int
+fold(struct access_profile *ap)
+{
+  const char *path = ap_get_path(ap);
+  struct hash_entry *entry;
+  int created, res = 0;
+
+  pthread_mutex_lock(&fold_lock);
+  entry = hash_lookup(fold_table, &path, sizeof(path));
+  if (entry != NULL) {
+    ap_merge(*(struct access_profile **)hash_entry_data(entry), ap);
+    res = 1;
+  } else if (nfolded < fold_max) {
+    entry = hash_enter(fold_table, &path, sizeof(path),
+		       sizeof(struct access_profile *), &created);
+    if (entry != NULL) {
+      *(struct access_profile **)hash_entry_data(entry) = ap;
+      fold_list[nfolded] = ap;
+      __atomic_store_n(&nfolded, nfolded + 1, __ATOMIC_RELAXED);
+      res = 2;
+    }
+  }
+  pthread_mutex_unlock(&fold_lock);
+
+  if (res != 0)
+    counter_add(COUNTER_QUEUED, 1); /* to be logged with the summary */
+  if (res == 1)
+    ap_free(ap);
+
+  return res;
+}
+
+/* take out a summary to log; NULL if there is none */
+static struct access_profile *
+unfold()
+{
+  struct access_profile *ap = NULL;
+  const char *path;
+
+  pthread_mutex_lock(&fold_lock);
+  if (nfolded > 0) {
+    ap = fold_list[nfolded - 1];
+    __atomic_store_n(&nfolded, nfolded - 1, __ATOMIC_RELAXED);
+    path = ap_get_path(ap);
+    hash_purge(fold_table, &path, sizeof(path));
+  }
+  pthread_mutex_unlock(&fold_lock);
+
+  return ap;
+}
+
+static int
+sampled_out()
+{
+  unsigned int shift = __atomic_load_n(&sample_shift, __ATOMIC_RELAXED);
+
+  if (shift == 0)
+    return 0;
+
+  return (++sample_seq & ((1UL << shift) - 1)) != 0;
+}
+
+static void
+report_overflow()
+{
+  static const char *what[] = {
+    [APQ_BLOCK] = "queue full : blocking closes",
+    [APQ_DROP] = "queue full : dropping profiles",
+    [APQ_FOLD] = "queue full : folding profiles",
+  };
+
+  if (!__atomic_exchange_n(&overflow_reported, 1, __ATOMIC_RELAXED))
+    monfs_msg(what[overflow]);
 }
 
+/*
+ * Queue a closed profile for the logger, which takes it over in any
+ * case: if the queue is full it is handled by the overflow policy.
+ */
 int
 apq_enqueue(struct access_profile *ap)
 {
-  if (enqueue(apq, (void *)ap) != 0)
-    return MONFS_ERR_APQ_ENQ;
+  int sampled = sampled_out();
+
+  if (!sampled) {
+    if (enqueue(apq, (void *)ap) == 0)
+      goto queued;
+
+    report_overflow();
+    if (overflow == APQ_BLOCK) {
+      counter_add(COUNTER_BLOCKED, 1);
+      if (enqueue_wait(apq, (void *)ap) == 0)
+	goto queued;
+    }
+  }
+
+  if (overflow == APQ_FOLD && fold(ap)) {
+    counter_add(COUNTER_FOLDED, 1);
+    return MONFS_OK;
+  }
+
+  counter_add(sampled ? COUNTER_SAMPLED_OUT : COUNTER_DROPPED, 1);
+  ap_free(ap);
+  return MONFS_OK;
 
+ queued:
+  counter_add(COUNTER_QUEUED, 1);
   return MONFS_OK;
 }
 
+/*
+ * Queued profiles come first, summaries once the queue is empty, or
+ * before if half of their room is taken.
+ */
 int
 apq_dequeue(struct access_profile **app)
 {
-  void *ap;
+  void *ap = NULL;
+  unsigned long n = __atomic_load_n(&nfolded, __ATOMIC_RELAXED);
+
+  if (n > 0 && n >= fold_max / 2) {
+    *app = unfold();
+    if (*app != NULL)
+      return MONFS_OK;
+  }
 
   if (dequeue(apq, &ap) != 0) {
     *app = NULL;
     return MONFS_ERR_APQ_DEQ;
   } 
 
+  if (ap == NULL && n > 0)
+    ap = unfold();
+
   *app = (struct access_profile *)ap;
   return MONFS_OK;
 }
 
+/*
+ * Called by the logger between batches with queue_sampling: while the
+ * queue stays over half full, halve the share of profiles queued every
+ * APQ_SAMPLE_PERIOD, and double it again while it stays under an eighth.
+ */
+void
+apq_update_sampling()
+{
+  unsigned long long now;
+  unsigned long len, cap;
+  unsigned int shift = sample_shift;
+  char buf[64];
+
+  if (!monfs_config_get_queue_sampling() || overflow == APQ_BLOCK)
+    return;
+
+  now = monfs_clock_ns();
+  if (now - sample_changed < APQ_SAMPLE_PERIOD)
+    return;
+
+  len = queue_length(apq);
+  cap = queue_capacity(apq);
+  if (len > cap / 2 && shift < APQ_SAMPLE_MAX_SHIFT)
+    shift++;
+  else if (len < cap / 8 && shift > 0)
+    shift--;
+  else
+    return;
+
+  sample_changed = now;
+  __atomic_store_n(&sample_shift, shift, __ATOMIC_RELAXED);
+  snprintf(buf, sizeof(buf), "queue sampling : 1 in %lu", 1UL << shift);
+  monfs_msg(buf);
+}
+
 int
-apq_wait() {
-  if (queue_wait(apq) != 0)
+apq_wait(long msec) {
+  if (queue_wait(apq, msec) != 0)
     return MONFS_ERR_APQ_WAIT;
 
   return MONFS_OK;
 }
+
+void
+apq_close()
+{
+  queue_close(apq);
+}
+
+int
+apq_is_closed()
+{
+  return queue_is_closed(apq);
+}
+
+unsigned long
+apq_length()
+{
+  return queue_length(apq);
+}
+
+void
+apq_get_stats(struct apq_stats *stats)
+{
+  stats->length = queue_length(apq);
+  stats->capacity = queue_capacity(apq);
+  stats->bytes = stats->length * ap_memory_size();
+  stats->summaries = __atomic_load_n(&nfolded, __ATOMIC_RELAXED);
+  stats->sample_rate = 1UL << __atomic_load_n(&sample_shift, __ATOMIC_RELAXED);
+}
@@ -23,10 +23,23 @@
 #ifndef ACCESS_PROFILE_QUEUE_H_
 #define ACCESS_PROFILE_QUEUE_H_
 
+struct apq_stats {
+  unsigned long length;
+  unsigned long capacity;
+  unsigned long long bytes;	/* held by queued profiles, at most */
+  unsigned long summaries;	/* folded paths waiting to be logged */
+  unsigned long sample_rate;	/* 1 in sample_rate profiles queued */
+};
+
 int apq_init();
 void apq_destroy();
 int apq_enqueue(struct access_profile *);
 int apq_dequeue(struct access_profile **);
-int apq_wait();
+int apq_wait(long);
+void apq_close();
+int apq_is_closed();
+unsigned long apq_length();
+void apq_update_sampling();
+void apq_get_stats(struct apq_stats *);
 
 #endif /* ACCESS_PROFILE_QUEUE_H_ */
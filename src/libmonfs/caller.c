@@ -0,0 +1,252 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <monfs.h>
+#include "config.h"
+#include "strtab.h"
+#include "caller.h"
+
+/*
+ * Cache of pid -> executable path.
+ *
+ * Resolving the caller means a readlink() of /proc/<pid>/exe for every
+ * open.  Entries here are keyed by pid and validated against the start
+ * time of the process (field 22 of /proc/<pid>/stat), so a reused pid is
+ * detected.  Since pids are only reused after wrapping around pid_max,
+ * an entry validated less than caller_cache_ttl msec ago is trusted
+ * without any system call.
+ *
+ * The cache is direct-mapped; slots are protected by striped locks,
+ * which also guard the per-stripe counters.
+ */
+
+#define CALLER_CACHE_SIZE 1024
+#define CALLER_CACHE_LOCKS 64
+
+struct caller_entry {
+  pid_t pid;
+  unsigned long long start_time;
+  unsigned long long checked;	/* msec, CLOCK_MONOTONIC_COARSE */
+  const char *exe;		/* interned */
+};
+
+struct caller_lock {
+  pthread_mutex_t mutex;
+  struct caller_cache_stats stats;
+} __attribute__((aligned(64)));
+
+static struct caller_entry cache[CALLER_CACHE_SIZE];
+static struct caller_lock locks[CALLER_CACHE_LOCKS];
+
+static unsigned long long
+now_msec()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/* start time of pid in clock ticks since boot, 0 if it is gone */
+static unsigned long long
+get_start_time(pid_t pid)
+{
+  char path[64], buf[1024], *p;
+  unsigned long long start_time;
+  ssize_t len;
+  int fd, i;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return 0;
+  len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (len <= 0)
+    return 0;
+  buf[len] = '\0';
+
+  /* comm may contain anything, so start after its closing paren */
+  p = strrchr(buf, ')');
+  if (p == NULL)
+    return 0;
+
+  /* skip fields 3 (state) to 21 */
+  for (i = 0; i < 20; i++) {
+    p = strchr(p + 1, ' ');
+    if (p == NULL)
+      return 0;
+  }
+
+  if (sscanf(p + 1, "%llu", &start_time) != 1)
+    return 0;
+
+  return start_time;
+}
+
+static const char *
+read_exe(pid_t pid)
+{
+  char exe[64], caller[PATH_MAX + 1];
+  ssize_t res;
+
+  snprintf(exe, sizeof(exe), "/proc/%d/exe", (int)pid);
+
+  res = readlink(exe, caller, sizeof(caller) - 1);
+  if (res == -1)
+    return NULL;
+  caller[res] = '\0';
+
+  return str_intern(caller);
+}
+
+static struct caller_entry *
+get_entry(pid_t pid)
+{
+  return &cache[((unsigned int)pid * 2654435761U) % CALLER_CACHE_SIZE];
+}
+
+static struct caller_lock *
+get_lock(struct caller_entry *entry)
+{
+  return &locks[(entry - cache) % CALLER_CACHE_LOCKS];
+}
+
+void
+caller_cache_init()
+{
+  int i;
+
+  memset(cache, 0, sizeof(cache));
+  for (i = 0; i < CALLER_CACHE_LOCKS; i++) {
+    pthread_mutex_init(&(locks[i].mutex), NULL);
+    memset(&(locks[i].stats), 0, sizeof(locks[i].stats));
+  }
+}
+
+void
+caller_cache_destroy()
+{
+  int i;
+
+  for (i = 0; i < CALLER_CACHE_SIZE; i++) {
+    str_release(cache[i].exe);
+    cache[i].exe = NULL;
+    cache[i].pid = 0;
+  }
+  for (i = 0; i < CALLER_CACHE_LOCKS; i++)
+    pthread_mutex_destroy(&(locks[i].mutex));
+}
+
+/*
+ * Returns a reference to the interned executable path of pid if the
+ * cache can answer without any system call, NULL otherwise.
+ */
+const char *
+caller_lookup_cached(pid_t pid)
+{
+  struct caller_entry *entry = get_entry(pid);
+  struct caller_lock *lock = get_lock(entry);
+  const char *exe = NULL;
+  unsigned long long ttl = monfs_config_get_caller_cache_ttl();
+
+  pthread_mutex_lock(&(lock->mutex));
+  if (entry->pid == pid && entry->exe != NULL &&
+      now_msec() - entry->checked < ttl) {
+    exe = str_ref(entry->exe);
+    lock->stats.hits++;
+  }
+  pthread_mutex_unlock(&(lock->mutex));
+
+  return exe;
+}
+
+/* Returns a reference to the interned executable path of pid, or NULL. */
+const char *
+caller_lookup(pid_t pid)
+{
+  struct caller_entry *entry = get_entry(pid);
+  struct caller_lock *lock = get_lock(entry);
+  const char *exe, *old = NULL;
+  unsigned long long start_time, now;
+
+  exe = caller_lookup_cached(pid);
+  if (exe != NULL)
+    return exe;
+
+  start_time = get_start_time(pid);
+  if (start_time == 0)
+    return NULL; /* already gone */
+
+  now = now_msec();
+  pthread_mutex_lock(&(lock->mutex));
+  if (entry->pid == pid && entry->exe != NULL) {
+    if (entry->start_time == start_time) {
+      entry->checked = now;
+      exe = str_ref(entry->exe);
+      lock->stats.hits++;
+      pthread_mutex_unlock(&(lock->mutex));
+      return exe;
+    }
+    lock->stats.reused++;
+  }
+  lock->stats.misses++;
+  pthread_mutex_unlock(&(lock->mutex));
+
+  exe = read_exe(pid);
+  if (exe == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&(lock->mutex));
+  old = entry->exe;
+  entry->pid = pid;
+  entry->start_time = start_time;
+  entry->checked = now;
+  entry->exe = str_ref(exe);
+  pthread_mutex_unlock(&(lock->mutex));
+
+  str_release(old);
+
+  return exe;
+}
+
+void
+caller_cache_get_stats(struct caller_cache_stats *stats)
+{
+  int i;
+
+  memset(stats, 0, sizeof(*stats));
+  for (i = 0; i < CALLER_CACHE_LOCKS; i++) {
+    pthread_mutex_lock(&(locks[i].mutex));
+    stats->hits += locks[i].stats.hits;
+    stats->misses += locks[i].stats.misses;
+    stats->reused += locks[i].stats.reused;
+    pthread_mutex_unlock(&(locks[i].mutex));
+  }
+}
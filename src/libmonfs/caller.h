@@ -0,0 +1,40 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef CALLER_H_
+#define CALLER_H_
+
+#include <sys/types.h>
+
+struct caller_cache_stats {
+  unsigned long long hits;
+  unsigned long long misses;
+  unsigned long long reused;	/* pid was reused by another process */
+};
+
+void caller_cache_init();
+void caller_cache_destroy();
+const char *caller_lookup(pid_t);
+const char *caller_lookup_cached(pid_t);
+void caller_cache_get_stats(struct caller_cache_stats *);
+
+#endif /* CALLER_H_ */
@@ -0,0 +1,133 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include <time.h>
+#include <monfs.h>
+#include "config.h"
+#include "clock.h"
+#include "error.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+/*
+ * Monotonic clock in nanoseconds.
+ *
+ * By default this is CLOCK_MONOTONIC (a vDSO call on Linux).  With
+ * clock_tsc set and an invariant TSC available, the TSC is calibrated
+ * against CLOCK_MONOTONIC at init and read directly; its values stay on
+ * the CLOCK_MONOTONIC time line.
+ */
+
+static int use_tsc = 0;
+
+#ifdef HAVE_TSC
+#define TSC_SHIFT 32
+
+static unsigned long long tsc_base;	/* TSC at calibration */
+static unsigned long long ns_base;	/* CLOCK_MONOTONIC at calibration */
+static unsigned long long tsc_mult;	/* ns per tick << TSC_SHIFT */
+
+static int
+tsc_invariant()
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    return 0;
+
+  return (edx & (1U << 8)) != 0;
+}
+#endif
+
+static unsigned long long
+clock_ns(clockid_t id)
+{
+  struct timespec ts;
+
+  clock_gettime(id, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+monfs_clock_init()
+{
+#ifdef HAVE_TSC
+  struct timespec wait = { 0, 20000000 }; /* 20 msec */
+  unsigned long long t0, t1, c0, c1;
+
+  use_tsc = 0;
+  if (!monfs_config_get_clock_tsc())
+    return;
+
+  if (!tsc_invariant()) {
+    monfs_msg("clock : no invariant TSC, using CLOCK_MONOTONIC");
+    return;
+  }
+
+  t0 = clock_ns(CLOCK_MONOTONIC);
+  c0 = __rdtsc();
+  nanosleep(&wait, NULL);
+  t1 = clock_ns(CLOCK_MONOTONIC);
+  c1 = __rdtsc();
+
+  if (c1 <= c0 || t1 <= t0)
+    return;
+
+  tsc_mult = (unsigned long long)
+    (((unsigned __int128)(t1 - t0) << TSC_SHIFT) / (c1 - c0));
+  tsc_base = c1;
+  ns_base = t1;
+  use_tsc = 1;
+#else
+  if (monfs_config_get_clock_tsc())
+    monfs_msg("clock : no TSC on this platform, using CLOCK_MONOTONIC");
+#endif
+}
+
+unsigned long long
+monfs_clock_ns()
+{
+#ifdef HAVE_TSC
+  if (use_tsc)
+    return ns_base + (unsigned long long)
+      (((unsigned __int128)(__rdtsc() - tsc_base) * tsc_mult) >> TSC_SHIFT);
+#endif
+
+  return clock_ns(CLOCK_MONOTONIC);
+}
+
+/* wall clock, for time stamps */
+unsigned long long
+monfs_clock_realtime_ns()
+{
+  return clock_ns(CLOCK_REALTIME);
+}
+
+int
+monfs_clock_is_tsc()
+{
+  return use_tsc;
+}
@@ -0,0 +1,31 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+void monfs_clock_init();
+unsigned long long monfs_clock_ns();
+unsigned long long monfs_clock_realtime_ns();
+int monfs_clock_is_tsc();
+
+#endif /* CLOCK_H_ */
@@ -21,20 +21,187 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <monfs.h>
 #include "config.h"
+#include "filter.h"
 #include "error.h"
 
-char *monfs_config_file = MONFS_CONFIG;
+const char *monfs_config_file = MONFS_CONFIG;
 char *db_path = "/tmp/monfs.db";
 int db_path_need_free = 0;
 
+/*
+ * Tunables settable by name (mount options)
+ */
+static int log_batch_size = 1024;
+static int log_batch_time = 100; /* msec */
+static int queue_size = 65536;
+static char *queue_overflow = NULL; /* block, drop or fold; drop if unset */
+static int queue_memory = 0; /* MB, 0 for no limit */
+static int queue_sampling = 0;
+static int caller_cache_ttl = 1000; /* msec */
+static int caller_defer = 0;
+static int clock_tsc = 0;
+static char *trace_path = NULL;
+static int trace_size = 1024; /* MB */
+static char *logger = NULL; /* backend, sqlite if unset */
+static int op_stats_interval = 10; /* sec, 0 disables */
+static int op_stats_callers = 0;
+static int db_rotate = 0; /* sec, 0 disables */
+static int db_rotate_size = 0; /* MB, 0 disables; checked at most once a second */
+static int db_retention = 0; /* hours, 0 keeps every segment */
+static char *db_staging = NULL; /* off, wal or memory; off if unset */
+static int db_backup_interval = 10; /* sec, for db_staging = memory */
+static int read_copy = 0;
+
+struct config_param {
+  const char *name;
+  int *value;
+  int min;
+  char **string; /* instead of value for string parameters */
+};
+
+static struct config_param config_params[] = {
+  { "log_batch_size", &log_batch_size, 1, NULL },
+  { "log_batch_time", &log_batch_time, 0, NULL },
+  { "queue_size", &queue_size, 2, NULL },
+  { "queue_overflow", NULL, 0, &queue_overflow },
+  { "queue_memory", &queue_memory, 0, NULL },
+  { "queue_sampling", &queue_sampling, 0, NULL },
+  { "caller_cache_ttl", &caller_cache_ttl, 0, NULL },
+  { "caller_defer", &caller_defer, 0, NULL },
+  { "clock_tsc", &clock_tsc, 0, NULL },
+  { "trace_path", NULL, 0, &trace_path },
+  { "trace_size", &trace_size, 1, NULL },
+  { "logger", NULL, 0, &logger },
+  { "op_stats_interval", &op_stats_interval, 0, NULL },
+  { "op_stats_callers", &op_stats_callers, 0, NULL },
+  { "db_rotate", &db_rotate, 0, NULL },
+  { "db_rotate_size", &db_rotate_size, 0, NULL },
+  { "db_retention", &db_retention, 0, NULL },
+  { "db_staging", NULL, 0, &db_staging },
+  { "db_backup_interval", &db_backup_interval, 1, NULL },
+  { "read_copy", &read_copy, 0, NULL },
+  { NULL, NULL, 0, NULL }
+};
+
+int
+monfs_config_set(const char *name, const char *value)
+{
+  struct config_param *p;
+  char *end;
+  long v;
+
+  if (name == NULL || value == NULL)
+    return MONFS_ERR_CONF_PARSE;
+
+  for (p = config_params; p->name != NULL; p++) {
+    if (strcmp(p->name, name) != 0)
+      continue;
+
+    if (p->string != NULL) {
+      free(*(p->string));
+      *(p->string) = strdup(value);
+      return (*(p->string) != NULL ? MONFS_OK : MONFS_ERR_NO_MEMORY);
+    }
+
+    v = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || v < p->min)
+      return MONFS_ERR_CONF_PARSE;
+
+    *(p->value) = (int)v;
+    return MONFS_OK;
+  }
+
+  return MONFS_ERR_CONF_PARSE;
+}
+
 void
-monfs_config_set_filename(char *filename)
+monfs_config_set_filename(const char *filename)
 {
   monfs_config_file = filename;
 }
 
+const char *
+monfs_config_get_filename()
+{
+  return monfs_config_file;
+}
+
+static int
+is_space(char c)
+{
+  return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+}
+
+/*
+ * One setting per line, blank lines and lines starting with # ignored:
+ *
+ *   log_batch_size = 512
+ *   exclude /tmp
+ *   include /data/run*
+ *
+ * Settings take the same names as monfs_config_set(), the filter rules
+ * are described in filter.c.
+ */
+int
+monfs_config_read()
+{
+  FILE *fp;
+  char *line = NULL, *key, *value, *end, where[PATH_MAX + 32];
+  size_t n = 0;
+  int lineno = 0, res = MONFS_OK;
+
+  fp = fopen(monfs_config_file, "r");
+  if (fp == NULL)
+    return MONFS_ERR_CONF_OPEN;
+
+  while (getline(&line, &n, fp) != -1) {
+    lineno++;
+
+    for (key = line; is_space(*key); key++)
+      ;
+    if (*key == '\0' || *key == '#')
+      continue;
+
+    for (end = key + strlen(key); end > key && is_space(end[-1]); end--)
+      ;
+    *end = '\0';
+
+    for (value = key; *value != '\0' && !is_space(*value) && *value != '='; value++)
+      ;
+    if (*value != '\0')
+      *value++ = '\0';
+    while (is_space(*value))
+      value++;
+    if (*value == '=')
+      value++;
+    while (is_space(*value))
+      value++;
+
+    if (strcmp(key, "include") == 0)
+      res = filter_add(1, value);
+    else if (strcmp(key, "exclude") == 0)
+      res = filter_add(0, value);
+    else
+      res = monfs_config_set(key, value);
+
+    if (res != MONFS_OK) {
+      snprintf(where, sizeof(where), "%s:%d: %s",
+	       monfs_config_file, lineno, key);
+      monfs_err_msg(res, where);
+      break;
+    }
+  }
+
+  free(line);
+  fclose(fp);
+  return res;
+}
+
 void
 monfs_config_set_db_path(char *path) {
   db_path = path;
@@ -52,3 +219,139 @@ monfs_config_free_db_path()
   if (db_path_need_free)
     free(db_path);
 }
+
+int
+monfs_config_get_log_batch_size()
+{
+  return log_batch_size;
+}
+
+int
+monfs_config_get_log_batch_time()
+{
+  return log_batch_time;
+}
+
+int
+monfs_config_get_queue_size()
+{
+  return queue_size;
+}
+
+int
+monfs_config_get_caller_cache_ttl()
+{
+  return caller_cache_ttl;
+}
+
+const char *
+monfs_config_get_queue_overflow()
+{
+  return (queue_overflow != NULL ? queue_overflow : "drop");
+}
+
+int
+monfs_config_get_queue_memory()
+{
+  return queue_memory;
+}
+
+int
+monfs_config_get_queue_sampling()
+{
+  return queue_sampling;
+}
+
+int
+monfs_config_get_caller_defer()
+{
+  return caller_defer;
+}
+
+int
+monfs_config_get_clock_tsc()
+{
+  return clock_tsc;
+}
+
+const char *
+monfs_config_get_trace_path()
+{
+  return trace_path;
+}
+
+int
+monfs_config_get_trace_size()
+{
+  return trace_size;
+}
+
+const char *
+monfs_config_get_logger()
+{
+  return (logger != NULL ? logger : "sqlite");
+}
+
+int
+monfs_config_get_op_stats_interval()
+{
+  return op_stats_interval;
+}
+
+int
+monfs_config_get_op_stats_callers()
+{
+  return op_stats_callers;
+}
+
+int
+monfs_config_get_db_rotate()
+{
+  return db_rotate;
+}
+
+int
+monfs_config_get_db_rotate_size()
+{
+  return db_rotate_size;
+}
+
+int
+monfs_config_get_db_retention()
+{
+  return db_retention;
+}
+
+const char *
+monfs_config_get_db_staging()
+{
+  return (db_staging != NULL ? db_staging : "off");
+}
+
+int
+monfs_config_get_db_backup_interval()
+{
+  return db_backup_interval;
+}
+
+int
+monfs_config_get_read_copy()
+{
+  return read_copy;
+}
+
+void
+monfs_config_free()
+{
+  struct config_param *p;
+
+  monfs_config_free_db_path();
+  filter_destroy();
+
+  for (p = config_params; p->name != NULL; p++) {
+    if (p->string != NULL) {
+      free(*(p->string));
+      *(p->string) = NULL;
+    }
+  }
+}
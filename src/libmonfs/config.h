@@ -27,11 +27,34 @@
 #define MONFS_CONFIG "/etc/monfs.conf"
 #endif
 
-void monfs_config_set_filename(char *);
+void monfs_config_set_filename(const char *);
+const char * monfs_config_get_filename();
 int monfs_config_read();
 void monfs_config_set_db_path(char *);
 char * monfs_config_get_db_path();
 void monfs_config_free_db_path();
+int monfs_config_set(const char *, const char *);
+int monfs_config_get_log_batch_size();
+int monfs_config_get_log_batch_time();
+int monfs_config_get_queue_size();
+const char * monfs_config_get_queue_overflow();
+int monfs_config_get_queue_memory();
+int monfs_config_get_queue_sampling();
+int monfs_config_get_caller_cache_ttl();
+int monfs_config_get_caller_defer();
+int monfs_config_get_clock_tsc();
+const char * monfs_config_get_trace_path();
+int monfs_config_get_trace_size();
+const char * monfs_config_get_logger();
+int monfs_config_get_op_stats_interval();
+int monfs_config_get_op_stats_callers();
+int monfs_config_get_db_rotate();
+int monfs_config_get_db_rotate_size();
+int monfs_config_get_db_retention();
+const char * monfs_config_get_db_staging();
+int monfs_config_get_db_backup_interval();
+int monfs_config_get_read_copy();
+void monfs_config_free();
 
 #endif /* CONFIG_H_ */
 
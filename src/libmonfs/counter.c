@@ -0,0 +1,124 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+/*
+ * Global event counters for the live statistics.  Each thread counts
+ * into its own set with plain stores, so the data path takes no lock
+ * and shares no cache line; counter_sum() adds the sets up on demand.
+ * The counts of exited threads are folded into a retired set.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <monfs.h>
+#include "counter.h"
+
+struct counter_set {
+  uint64_t v[COUNTERS];
+  struct counter_set *next;
+} __attribute__((aligned(64)));
+
+static pthread_mutex_t sets_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct counter_set *sets = NULL;
+static uint64_t retired[COUNTERS];
+static pthread_key_t counter_key;
+static pthread_once_t counter_key_once = PTHREAD_ONCE_INIT;
+static __thread struct counter_set *thread_set = NULL;
+
+/* thread exit */
+static void
+counter_set_release(void *arg)
+{
+  struct counter_set *c = arg, **p;
+  int i;
+
+  pthread_mutex_lock(&sets_lock);
+  for (i = 0; i < COUNTERS; i++)
+    retired[i] += c->v[i];
+  for (p = &sets; *p != NULL; p = &((*p)->next)) {
+    if (*p == c) {
+      *p = c->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&sets_lock);
+
+  free(c);
+}
+
+static void
+counter_key_create()
+{
+  pthread_key_create(&counter_key, counter_set_release);
+}
+
+static struct counter_set *
+counter_set_get()
+{
+  struct counter_set *c;
+
+  if (posix_memalign((void **)&c, 64, sizeof(*c)) != 0)
+    return NULL;
+  memset(c->v, 0, sizeof(c->v));
+
+  pthread_once(&counter_key_once, counter_key_create);
+  pthread_setspecific(counter_key, c);
+
+  pthread_mutex_lock(&sets_lock);
+  c->next = sets;
+  sets = c;
+  pthread_mutex_unlock(&sets_lock);
+
+  thread_set = c;
+  return c;
+}
+
+void
+counter_add(int id, uint64_t n)
+{
+  struct counter_set *c = thread_set;
+
+  if (c == NULL) {
+    c = counter_set_get();
+    if (c == NULL)
+      return;
+  }
+
+  /* only this thread writes the set, the store just must not tear */
+  __atomic_store_n(&(c->v[id]), c->v[id] + n, __ATOMIC_RELAXED);
+}
+
+void
+counter_sum(uint64_t *sum)
+{
+  struct counter_set *c;
+  int i;
+
+  pthread_mutex_lock(&sets_lock);
+  memcpy(sum, retired, sizeof(retired));
+  for (c = sets; c != NULL; c = c->next) {
+    for (i = 0; i < COUNTERS; i++)
+      sum[i] += __atomic_load_n(&(c->v[i]), __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&sets_lock);
+}
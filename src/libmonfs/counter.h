@@ -0,0 +1,49 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef COUNTER_H_
+#define COUNTER_H_
+
+#include <stdint.h>
+
+enum counter_id {
+  COUNTER_OPENS,
+  COUNTER_FILTERED,
+  COUNTER_CLOSES,
+  COUNTER_QUEUED,		/* closes handed to the logger, folded or not */
+  COUNTER_LOGGED,		/* of those, committed */
+  COUNTER_LOGGER_DROPPED,	/* lost to a failed transaction, also dropped */
+  COUNTER_DROPPED,
+  COUNTER_FOLDED,
+  COUNTER_BLOCKED,
+  COUNTER_SAMPLED_OUT,
+  COUNTER_READS,
+  COUNTER_WRITES,
+  COUNTER_READ_BYTES,
+  COUNTER_WRITE_BYTES,
+  COUNTERS
+};
+
+void counter_add(int, uint64_t);
+void counter_sum(uint64_t *);
+
+#endif /* COUNTER_H_ */
@@ -42,20 +42,19 @@ static const char *monfs_err_str[MONFS_ERR_NUMBER] = {
   "queue wait failed",
   /* logger error */
   "logger initialization failed",
+  "can't write log",
   /* db error */
   "db initialization failed",
   "can't open db",
   "can't execute db operation"
 };
 
-#if 0
 void monfs_msg(const char  *str)
 {
   if (str == NULL)
     str = "";
   fprintf(stderr, "MONFS : %s\n", str);
 }
-#endif
 
 void monfs_err_msg(int no, const char *str)
 {
@@ -23,9 +23,7 @@
 #ifndef ERROR_H_
 #define ERROR_H_
 
-#if 0
 void monfs_msg(const char *);
-#endif
 void monfs_err_msg(int, const char *);
 
 #endif /* ERROR_H_ */
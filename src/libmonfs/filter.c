@@ -0,0 +1,281 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+/*
+ * Include/exclude rules from monfs.conf, compiled into a trie of path
+ * components:
+ *
+ *   exclude /tmp          prefix: /tmp and everything below it
+ *   include /data/run*    glob, anchored at the /data node
+ *   exclude *.so          glob without a slash: matched against the basename
+ *
+ * A path walks the trie once, checking the prefix rule and the globs of
+ * each node it passes.  As in rsync filters the last matching rule in
+ * the file wins; unmatched paths are monitored unless there is an
+ * include rule.  The trie is built before mounting and only read after.
+ */
+
+#define _GNU_SOURCE /* FNM_LEADING_DIR */
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <monfs.h>
+#include "filter.h"
+
+struct filter_glob {
+  char *pattern;
+  int rule;
+  int include;
+  int basename; /* match the last component only */
+  struct filter_glob *next;
+};
+
+struct filter_node {
+  char *name;
+  int len;
+  int rule; /* sequence number of the last prefix rule ending here, or 0 */
+  int include;
+  struct filter_glob *globs;
+  struct filter_node *child;
+  struct filter_node *next;
+};
+
+static struct filter_node *root = NULL;
+static int rules = 0;
+static int includes = 0;
+
+static const char *
+component_end(const char *p)
+{
+  while (*p != '\0' && *p != '/')
+    p++;
+  return p;
+}
+
+static struct filter_node *
+node_alloc(const char *name, int len)
+{
+  struct filter_node *node;
+
+  node = calloc(1, sizeof(struct filter_node));
+  if (node == NULL)
+    return NULL;
+
+  node->name = strndup(name, len);
+  if (node->name == NULL) {
+    free(node);
+    return NULL;
+  }
+  node->len = len;
+
+  return node;
+}
+
+static void
+node_free(struct filter_node *node)
+{
+  struct filter_node *child, *next_child;
+  struct filter_glob *glob, *next_glob;
+
+  for (child = node->child; child != NULL; child = next_child) {
+    next_child = child->next;
+    node_free(child);
+  }
+  for (glob = node->globs; glob != NULL; glob = next_glob) {
+    next_glob = glob->next;
+    free(glob->pattern);
+    free(glob);
+  }
+  free(node->name);
+  free(node);
+}
+
+static struct filter_node *
+node_child(struct filter_node *node, const char *name, int len)
+{
+  struct filter_node *child;
+
+  for (child = node->child; child != NULL; child = child->next) {
+    if (child->len == len && memcmp(child->name, name, len) == 0)
+      return child;
+  }
+
+  return NULL;
+}
+
+static int
+is_glob(const char *str, int len)
+{
+  int i;
+
+  for (i = 0; i < len; i++) {
+    if (str[i] == '*' || str[i] == '?' || str[i] == '[')
+      return 1;
+  }
+
+  return 0;
+}
+
+static int
+add_glob(struct filter_node *node, const char *pattern, int include,
+	 int basename)
+{
+  struct filter_glob *glob, **tail;
+
+  glob = malloc(sizeof(struct filter_glob));
+  if (glob == NULL)
+    return MONFS_ERR_NO_MEMORY;
+
+  glob->pattern = strdup(pattern);
+  if (glob->pattern == NULL) {
+    free(glob);
+    return MONFS_ERR_NO_MEMORY;
+  }
+  glob->rule = rules;
+  glob->include = include;
+  glob->basename = basename;
+  glob->next = NULL;
+
+  for (tail = &(node->globs); *tail != NULL; tail = &((*tail)->next))
+    ;
+  *tail = glob;
+
+  return MONFS_OK;
+}
+
+/* add a rule, include if include != 0; rules are numbered in call order */
+int
+filter_add(int include, const char *pattern)
+{
+  struct filter_node *node, *child;
+  const char *p, *end;
+  int len;
+
+  if (pattern == NULL || *pattern == '\0')
+    return MONFS_ERR_CONF_PARSE;
+
+  if (*pattern != '/' && strchr(pattern, '/') != NULL)
+    return MONFS_ERR_CONF_PARSE; /* relative path */
+
+  if (root == NULL) {
+    root = node_alloc("", 0);
+    if (root == NULL)
+      return MONFS_ERR_NO_MEMORY;
+  }
+
+  rules++;
+  if (include)
+    includes++;
+
+  if (*pattern != '/')
+    return add_glob(root, pattern, include, 1);
+
+  node = root;
+  for (p = pattern; ; p = end) {
+    while (*p == '/')
+      p++;
+    if (*p == '\0')
+      break;
+    end = component_end(p);
+    len = end - p;
+
+    if (is_glob(p, len))
+      return add_glob(node, p, include, 0);
+
+    child = node_child(node, p, len);
+    if (child == NULL) {
+      child = node_alloc(p, len);
+      if (child == NULL)
+	return MONFS_ERR_NO_MEMORY;
+      child->next = node->child;
+      node->child = child;
+    }
+    node = child;
+  }
+
+  node->rule = rules;
+  node->include = include;
+
+  return MONFS_OK;
+}
+
+/* returns 1 if path (absolute, below the mount point) is to be monitored */
+int
+filter_match(const char *path)
+{
+  struct filter_node *node;
+  struct filter_glob *glob;
+  const char *p, *end, *base;
+  int best = 0, include;
+
+  if (root == NULL)
+    return 1;
+
+  include = (includes == 0);
+  base = strrchr(path, '/');
+  base = (base != NULL ? base + 1 : path);
+
+  node = root;
+  p = path;
+  for (;;) {
+    if (node->rule > best) {
+      best = node->rule;
+      include = node->include;
+    }
+
+    while (*p == '/')
+      p++;
+
+    for (glob = node->globs; glob != NULL; glob = glob->next) {
+      if (glob->rule <= best)
+	continue;
+      if (glob->basename) {
+	if (fnmatch(glob->pattern, base, 0) != 0)
+	  continue;
+      } else if (*p == '\0' ||
+		 fnmatch(glob->pattern, p, FNM_PATHNAME | FNM_LEADING_DIR) != 0) {
+	continue;
+      }
+      best = glob->rule;
+      include = glob->include;
+    }
+
+    if (*p == '\0')
+      break;
+    end = component_end(p);
+    node = node_child(node, p, end - p);
+    if (node == NULL)
+      break;
+    p = end;
+  }
+
+  return include;
+}
+
+void
+filter_destroy()
+{
+  if (root != NULL)
+    node_free(root);
+  root = NULL;
+  rules = includes = 0;
+}
@@ -24,23 +24,60 @@
 #include <stdlib.h>
 #include <string.h>
 #include <monfs.h>
+#include "hash.h"
 
-#define ALIGNMENT 16
-#define ALIGN(p) (((unsigned long)(p) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+/*
+ * Open addressing hash table with linear probing.
+ *
+ * Keys and data up to HASH_INLINE bytes are stored in the slot itself,
+ * longer ones are allocated separately.  When the load factor exceeds
+ * HASH_MAX_LOAD the table doubles, but entries are moved over
+ * incrementally: every hash_enter()/hash_purge() migrates a few slots of
+ * the old array, and lookups consult both arrays meanwhile.  The old
+ * array only loses entries during migration and marks them as deleted,
+ * so that its probe sequences stay intact; the current array uses
+ * backward shift deletion and never has tombstones.
+ */
 
-int
+#define HASH_INLINE 16
+#define HASH_MIN_SIZE 8
+#define HASH_MAX_LOAD(cap) ((cap) - (cap) / 4)	/* 0.75 */
+#define HASH_MIGRATE_STEP 8
+
+/* 64-bit finalizer of MurmurHash3 */
+static uint64_t
+hash_mix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t
 hash_default(const void *key, int keylen)
 {
 	int i;
-	unsigned int hash = 0, g;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint32_t w32;
+	uint64_t w64;
+
+	/* word-sized keys (file handles, pointers) take the fast path */
+	if (keylen == sizeof(uint64_t)) {
+		memcpy(&w64, key, sizeof(w64));
+		return hash_mix64(w64);
+	}
+	if (keylen == sizeof(uint32_t)) {
+		memcpy(&w32, key, sizeof(w32));
+		return hash_mix64(w32);
+	}
 
+	/* FNV-1a */
 	for (i = 0; i < keylen; i++) {
-		hash = (hash << 4) + ((unsigned char *)key)[i];
-		/* this assumes size of `int` is 32 bit */
-		if (( g = hash & 0xf0000000) != 0) {
-			hash ^= g >> 24;
-			hash ^= g;
-		}
+		hash ^= ((const unsigned char *)key)[i];
+		hash *= 0x100000001b3ULL;
 	}
 
 	return (hash);
@@ -52,159 +89,268 @@ hash_key_equal_default(const void *key1, int key1len, const void *key2, int key2
 	return (key1len == key2len && memcmp(key1, key2, key1len) == 0);
 }
 
+enum hash_entry_state {
+	HASH_EMPTY = 0,
+	HASH_USED,
+	HASH_DELETED
+};
+
+union hash_field {
+	unsigned char bytes[HASH_INLINE];
+	void *ptr;
+	double align;
+};
+
 struct hash_entry {
-	struct hash_entry *next;
+	uint64_t hash;
 	int key_length;
 	int data_length;
-	double key_stub;
+	int state;
+	union hash_field key;
+	union hash_field data;
 };
 
 #define HASH_KEY(entry) \
-	(((char *)(entry)) + \
-	ALIGN(offsetof(struct hash_entry, key_stub)))
+	((entry)->key_length > HASH_INLINE ? \
+	 (entry)->key.ptr : (void *)(entry)->key.bytes)
 
 #define HASH_DATA(entry) \
-	(HASH_KEY(entry) + ALIGN((entry)->key_length))
+	((entry)->data_length > HASH_INLINE ? \
+	 (entry)->data.ptr : (void *)(entry)->data.bytes)
+
+struct hash_array {
+	struct hash_entry *entries;
+	size_t mask;
+	size_t used;
+};
 
 struct hash_table {
-	int table_size;
+	struct hash_array cur;
+	struct hash_array old;	/* entries != NULL while resizing */
+	size_t migrate_pos;
 
-	int (*hash)(const void *, int);
+	uint64_t (*hash)(const void *, int);
 	int (*equal)(const void *, int, const void *, int);
-
-	struct hash_entry *buckets[1];
 };
 
-static size_t
-size_mul(int *overflowp, size_t a, size_t b)
+static int
+hash_array_alloc(struct hash_array *a, size_t capacity)
 {
-	size_t product = a * b;
-
-	if (b != 0 && product / b != a)
-		*overflowp = 1;
+	a->entries = calloc(capacity, sizeof(struct hash_entry));
+	if (a->entries == NULL)
+		return 0;
+	a->mask = capacity - 1;
+	a->used = 0;
+	return 1;
+}
 
-	return product;
+static void
+hash_entry_release(struct hash_entry *p)
+{
+	if (p->key_length > HASH_INLINE)
+		free(p->key.ptr);
+	if (p->data_length > HASH_INLINE)
+		free(p->data.ptr);
 }
 
-static size_t
-size_add(int *overflowp, size_t a, size_t b)
+static void
+hash_array_free(struct hash_array *a)
 {
-	size_t sum = a + b;
+	size_t i;
 
-	if (sum < a)
-		*overflowp = 1;
-	return sum;
+	if (a->entries == NULL)
+		return;
+
+	for (i = 0; i <= a->mask; i++) {
+		if (a->entries[i].state == HASH_USED)
+			hash_entry_release(&a->entries[i]);
+	}
+	free(a->entries);
+	a->entries = NULL;
 }
 
 struct hash_table *
 hash_table_alloc(int size,
-		int (*hash)(const void *, int),
+		uint64_t (*hash)(const void *, int),
 		int (*equal)(const void *, int, const void *, int))
 {
 	struct hash_table *ht;
-	size_t alloc_size;
-	int overflow = 0;
-
-	alloc_size = size_add(&overflow,
-			sizeof(struct hash_table),
-			size_mul(&overflow,
-					sizeof(struct hash_entry *), size - 1));
-	if (overflow)
-		return NULL;
+	size_t capacity;
 
-	ht = malloc(alloc_size);
+	for (capacity = HASH_MIN_SIZE; capacity < (size_t)size; capacity <<= 1)
+		if (capacity > ((size_t)-1 >> 1) / sizeof(struct hash_entry))
+			return NULL;
+
+	ht = malloc(sizeof(*ht));
 	if (ht == NULL)
 		return NULL;
 
-	ht->table_size = size;
+	if (!hash_array_alloc(&ht->cur, capacity)) {
+		free(ht);
+		return NULL;
+	}
+	ht->old.entries = NULL;
+	ht->old.mask = 0;
+	ht->old.used = 0;
+	ht->migrate_pos = 0;
 	ht->hash = hash;
 	ht->equal = equal;
-	memset(ht->buckets, 0, sizeof(struct hash_entry *) * size);
 	return (ht);
 }
 
 void
 hash_table_free(struct hash_table *ht)
 {
-	int i;
-	struct hash_entry *p, *np;
+	if (ht == NULL)
+		return;
 
-	for (i = 0; i < ht->table_size; i++) {
-		for (p = ht->buckets[i]; p != NULL; p = np) {
-			np = p->next;
-			free(p);
-		}
-	}
+	hash_array_free(&ht->old);
+	hash_array_free(&ht->cur);
 	free(ht);
 }
 
-static struct hash_entry **
-hash_lookup_internal_search(struct hash_table *ht, struct hash_entry **pp, const void *key, int keylen)
+static struct hash_entry *
+hash_array_search(struct hash_table *ht, struct hash_array *a,
+		uint64_t h, const void *key, int keylen)
 {
 	struct hash_entry *p;
-	int (*equal)(const void *, int, const void *, int) = ht->equal;
+	size_t i;
+
+	for (i = h & a->mask; ; i = (i + 1) & a->mask) {
+		p = &a->entries[i];
+		if (p->state == HASH_EMPTY)
+			return NULL;
+		if (p->state == HASH_USED && p->hash == h &&
+		    (*ht->equal)(HASH_KEY(p), p->key_length, key, keylen))
+			return p;
+	}
+}
+
+/* first free slot for h; the caller guarantees there is one */
+static struct hash_entry *
+hash_array_slot(struct hash_array *a, uint64_t h)
+{
+	size_t i;
+
+	for (i = h & a->mask; a->entries[i].state != HASH_EMPTY;
+	     i = (i + 1) & a->mask)
+		;
+	return &a->entries[i];
+}
 
-	for (p = *pp; p != NULL; pp = &p->next, p = *pp) {
-		if ((*equal)(HASH_KEY(p), p->key_length, key, keylen))
-			break;
+static void
+hash_migrate(struct hash_table *ht, size_t steps)
+{
+	struct hash_entry *p;
+
+	while (ht->old.entries != NULL && steps-- > 0) {
+		p = &ht->old.entries[ht->migrate_pos];
+		if (p->state == HASH_USED) {
+			*hash_array_slot(&ht->cur, p->hash) = *p;
+			ht->cur.used++;
+			ht->old.used--;
+			p->state = HASH_DELETED;
+		}
+		if (ht->migrate_pos++ == ht->old.mask) {
+			free(ht->old.entries);
+			ht->old.entries = NULL;
+			ht->old.used = 0;
+			ht->migrate_pos = 0;
+		}
 	}
+}
+
+static int
+hash_grow(struct hash_table *ht)
+{
+	struct hash_array a;
+	size_t capacity = (ht->cur.mask + 1) * 2;
+
+	if (capacity > ((size_t)-1 >> 1) / sizeof(struct hash_entry))
+		return 0;
+
+	/* the previous resize must be complete before starting another */
+	hash_migrate(ht, (size_t)-1);
 
+	if (!hash_array_alloc(&a, capacity))
+		return 0;
 
-	return pp;
+	ht->old = ht->cur;
+	ht->cur = a;
+	ht->migrate_pos = 0;
+	return 1;
 }
 
-#define HASH_BUCKET(ht, key, keylen) \
-	((*ht->hash)(key, keylen) % ht->table_size)
+static struct hash_entry *
+hash_lookup_internal(struct hash_table *ht, uint64_t h, const void *key, int keylen)
+{
+	struct hash_entry *p;
 
-#define HASH_LOOKUP_INTERNAL(ht, key, keylen) \
-	hash_lookup_internal_search(ht, \
-			&ht->buckets[HASH_BUCKET(ht, key, keylen)], \
-			key, keylen)
+	p = hash_array_search(ht, &ht->cur, h, key, keylen);
+	if (p == NULL && ht->old.entries != NULL)
+		p = hash_array_search(ht, &ht->old, h, key, keylen);
+	return p;
+}
 
 struct hash_entry *
 hash_lookup(struct hash_table *ht, const void *key, int keylen)
 {
-	struct hash_entry **pp =
-		HASH_LOOKUP_INTERNAL(ht, key, keylen);
-
-	return *pp;
+	return hash_lookup_internal(ht, (*ht->hash)(key, keylen), key, keylen);
 }
 
 struct hash_entry *
 hash_enter(struct hash_table *ht, const void *key, int keylen, int datalen, int *createdp)
 {
-	struct hash_entry *p, **pp =
-		HASH_LOOKUP_INTERNAL(ht, key, keylen);
-	size_t hash_entry_size;
-	int overflow = 0;
+	struct hash_entry *p;
+	uint64_t h = (*ht->hash)(key, keylen);
+	void *key_ptr = NULL, *data_ptr = NULL;
 
 	if (createdp != NULL)
 		*createdp = 0;
 
-	if (*pp != NULL)
-		return *pp;
+	hash_migrate(ht, HASH_MIGRATE_STEP);
+
+	p = hash_lookup_internal(ht, h, key, keylen);
+	if (p != NULL)
+		return p;
 
 	/*
 	 * create if not found
 	 */
-	hash_entry_size =
-		size_add(&overflow,
-			size_add(&overflow,
-					ALIGN(offsetof(struct hash_entry, key_stub)),
-					ALIGN(keylen)),
-				datalen);
-	if (overflow)
-		return NULL;
+	if (keylen > HASH_INLINE) {
+		key_ptr = malloc(keylen);
+		if (key_ptr == NULL)
+			return NULL;
+	}
+	if (datalen > HASH_INLINE) {
+		data_ptr = malloc(datalen);
+		if (data_ptr == NULL) {
+			free(key_ptr);
+			return NULL;
+		}
+	}
 
-	p = malloc(hash_entry_size); /* size is already cheecked */
-	if (p == NULL)
-		return NULL;
+	if (ht->cur.used + ht->old.used + 1 > HASH_MAX_LOAD(ht->cur.mask + 1) &&
+	    !hash_grow(ht)) {
+		/* can't grow, but there is still room below 100% */
+		if (ht->cur.used + 1 > ht->cur.mask) {
+			free(key_ptr);
+			free(data_ptr);
+			return NULL;
+		}
+	}
 
-	*pp = p;
+	p = hash_array_slot(&ht->cur, h);
+	ht->cur.used++;
 
-	p->next = NULL;
+	p->hash = h;
+	p->state = HASH_USED;
 	p->key_length = keylen;
 	p->data_length = datalen;
+	if (key_ptr != NULL)
+		p->key.ptr = key_ptr;
+	if (data_ptr != NULL)
+		p->data.ptr = data_ptr;
 	memcpy(HASH_KEY(p), key, keylen);
 
 	if (createdp != NULL)
@@ -212,18 +358,64 @@ hash_enter(struct hash_table *ht, const void *key, int keylen, int datalen, int
 	return p;
 }
 
+/* backward shift deletion, keeps the current array free of tombstones */
+static void
+hash_array_remove(struct hash_array *a, struct hash_entry *p)
+{
+	size_t i, j, k;
+
+	i = p - a->entries;
+	for (j = (i + 1) & a->mask; a->entries[j].state != HASH_EMPTY;
+	     j = (j + 1) & a->mask) {
+		k = a->entries[j].hash & a->mask;
+		if ((j > i && (k <= i || k > j)) ||
+		    (j < i && (k <= i && k > j))) {
+			a->entries[i] = a->entries[j];
+			i = j;
+		}
+	}
+	a->entries[i].state = HASH_EMPTY;
+	a->used--;
+}
+
 int
 hash_purge(struct hash_table *ht, const void *key, int keylen)
 {
-	struct hash_entry *p, **pp =
-		HASH_LOOKUP_INTERNAL(ht, key, keylen);
+	struct hash_entry *p;
+	uint64_t h = (*ht->hash)(key, keylen);
 
-	p = *pp;
-	if (p == NULL)
-		return (0); /* key is not found */
-	*pp = p->next;
-	free(p);
-	return 1;
+	hash_migrate(ht, HASH_MIGRATE_STEP);
+
+	p = hash_array_search(ht, &ht->cur, h, key, keylen);
+	if (p != NULL) {
+		hash_entry_release(p);
+		hash_array_remove(&ht->cur, p);
+		return 1;
+	}
+
+	if (ht->old.entries != NULL) {
+		p = hash_array_search(ht, &ht->old, h, key, keylen);
+		if (p != NULL) {
+			hash_entry_release(p);
+			p->state = HASH_DELETED;
+			ht->old.used--;
+			return 1;
+		}
+	}
+
+	return (0); /* key is not found */
+}
+
+int
+hash_table_count(struct hash_table *ht)
+{
+	return (int)(ht->cur.used + ht->old.used);
+}
+
+double
+hash_table_load_factor(struct hash_table *ht)
+{
+	return (double)(ht->cur.used + ht->old.used) / (ht->cur.mask + 1);
 }
 
 void *
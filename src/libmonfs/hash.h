@@ -23,19 +23,27 @@
 #ifndef HASH_H_
 #define HASH_H_
 
-int hash_default(const void *, int);
+#include <stdint.h>
+
+uint64_t hash_default(const void *, int);
 int hash_key_equal_default(const void *, int, const void *, int);
 
 struct hash_table;
 struct hash_entry;	
 
+/*
+ * Entries returned by hash_lookup()/hash_enter() are only valid until the
+ * next hash_enter() or hash_purge() on the same table.
+ */
 struct hash_table * hash_table_alloc(int,
-		int (*)(const void *, int),
+		uint64_t (*)(const void *, int),
 		int (*)(const void *, int, const void *, int));
 void hash_table_free(struct hash_table *);
 struct hash_entry * hash_lookup(struct hash_table *, const void *, int);
 struct hash_entry * hash_enter(struct hash_table *, const void *, int, int, int *);
 int hash_purge(struct hash_table *, const void *, int);
+int hash_table_count(struct hash_table *);
+double hash_table_load_factor(struct hash_table *);
 
 void *hash_entry_key(struct hash_entry *);
 int hash_entry_key_length(struct hash_entry *);
@@ -0,0 +1,163 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include <string.h>
+#include "hist.h"
+
+static int
+bucket_index(unsigned long long v)
+{
+  int shift;
+
+  if (v < 2 * HIST_SUB)
+    return (int)v;
+
+  shift = (63 - __builtin_clzll(v)) - HIST_SUB_BITS;
+  if (shift > HIST_MAX_SHIFT)
+    return HIST_BUCKETS - 1;
+
+  return shift * HIST_SUB + (int)(v >> shift);
+}
+
+/* lowest value counted in bucket i */
+unsigned long long
+hist_bucket_low(int i)
+{
+  int shift;
+
+  if (i < 2 * HIST_SUB)
+    return (unsigned long long)i;
+
+  shift = i / HIST_SUB - 1;
+  return (unsigned long long)(i % HIST_SUB + HIST_SUB) << shift;
+}
+
+/* one past the highest value counted in bucket i */
+unsigned long long
+hist_bucket_high(int i)
+{
+  if (i < 2 * HIST_SUB)
+    return (unsigned long long)i + 1;
+
+  return hist_bucket_low(i) + (1ULL << (i / HIST_SUB - 1));
+}
+
+/* value reported for bucket i: its midpoint, but never above max */
+static unsigned long long
+bucket_value(int i, unsigned long long max)
+{
+  unsigned long long v;
+
+  v = (hist_bucket_low(i) + hist_bucket_high(i) - 1) / 2;
+  return v < max ? v : max;
+}
+
+void
+hist_clear(struct hist *h)
+{
+  memset(h, 0, sizeof(*h));
+}
+
+void
+hist_record(struct hist *h, unsigned long long v)
+{
+  unsigned long long max;
+
+  __atomic_add_fetch(&(h->counts[bucket_index(v)]), 1, __ATOMIC_RELAXED);
+
+  max = __atomic_load_n(&(h->max), __ATOMIC_RELAXED);
+  while (v > max &&
+	 !__atomic_compare_exchange_n(&(h->max), &max, v, 1,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/* add the counts of src to dst, which nobody else may update */
+void
+hist_merge(struct hist *dst, const struct hist *src)
+{
+  int i;
+
+  for (i = 0; i < HIST_BUCKETS; i++)
+    dst->counts[i] += src->counts[i];
+  if (src->max > dst->max)
+    dst->max = src->max;
+}
+
+/*
+ * Fill out[k] with the ps[k]-th percentile (0 < ps[k] <= 100, in
+ * ascending order), 0 if nothing was recorded.
+ */
+#define PERCENTILES(h, ps, out, n) do {					\
+    unsigned long long total = 0, seen = 0, rank;			\
+    int i, k = 0;							\
+									\
+    for (i = 0; i < HIST_BUCKETS; i++)					\
+      total += (h)->counts[i];						\
+									\
+    for (i = 0; i < HIST_BUCKETS && k < (n); i++) {			\
+      seen += (h)->counts[i];						\
+      while (k < (n)) {							\
+	rank = (unsigned long long)((ps)[k] / 100.0 * total + 0.999999); \
+	if (rank == 0)							\
+	  rank = 1;							\
+	if (seen < rank)						\
+	  break;							\
+	(out)[k++] = bucket_value(i, (h)->max);				\
+      }									\
+    }									\
+    while (k < (n))							\
+      (out)[k++] = total > 0 ? (h)->max : 0;				\
+  } while (0)
+
+void
+hist_percentiles(const struct hist *h, const double *ps,
+		 unsigned long long *out, int n)
+{
+  PERCENTILES(h, ps, out, n);
+}
+
+void
+hist_sum_clear(struct hist_sum *s)
+{
+  memset(s, 0, sizeof(*s));
+}
+
+void
+hist_sum_add(struct hist_sum *s, const struct hist *h)
+{
+  int i;
+
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    s->counts[i] += h->counts[i];
+    s->total += h->counts[i];
+  }
+  if (h->max > s->max)
+    s->max = h->max;
+}
+
+void
+hist_sum_percentiles(const struct hist_sum *s, const double *ps,
+		     unsigned long long *out, int n)
+{
+  PERCENTILES(s, ps, out, n);
+}
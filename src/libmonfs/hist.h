@@ -0,0 +1,65 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef HIST_H_
+#define HIST_H_
+
+#include <stdint.h>
+
+/*
+ * Log-linear latency histogram (nsec), HDR style: values below
+ * 2 * HIST_SUB are exact, above that every power of two is split into
+ * HIST_SUB linear buckets, i.e. about 2 significant digits.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_SHIFT 31	/* values >= 2^37 nsec share the last bucket */
+#define HIST_BUCKETS ((HIST_MAX_SHIFT + 2) * HIST_SUB)
+
+/* per handle; concurrent hist_record() callers are fine */
+struct hist {
+  unsigned long long max;
+  uint32_t counts[HIST_BUCKETS];
+};
+
+/* per mount; single writer */
+struct hist_sum {
+  unsigned long long total;
+  unsigned long long max;
+  uint64_t counts[HIST_BUCKETS];
+};
+
+void hist_clear(struct hist *);
+void hist_record(struct hist *, unsigned long long);
+void hist_merge(struct hist *, const struct hist *);
+void hist_percentiles(const struct hist *, const double *,
+		      unsigned long long *, int);
+
+void hist_sum_clear(struct hist_sum *);
+void hist_sum_add(struct hist_sum *, const struct hist *);
+void hist_sum_percentiles(const struct hist_sum *, const double *,
+			  unsigned long long *, int);
+
+unsigned long long hist_bucket_low(int);
+unsigned long long hist_bucket_high(int);
+
+#endif /* HIST_H_ */
@@ -20,119 +20,248 @@
  * See the file COPYING.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <sqlite3.h>
 #include <monfs.h>
 #include "access_profile.h"
 #include "access_profile_queue.h"
+#include "config.h"
 #include "logger.h"
+#include "logger_backend.h"
+#include "pool.h"
+#include "caller.h"
+#include "clock.h"
+#include "strtab.h"
+#include "hist.h"
+#include "opstat.h"
 #include "error.h"
+#include "counter.h"
+
 
+static const struct logger_backend *backends[] = {
+  &sqlite_logger,
+  &file_logger,
+  &null_logger,
+  NULL
+};
 
-static sqlite3 *log = NULL;
+static const struct logger_backend *backend = NULL;
+static struct hist_sum r_latency, w_latency; /* per mount, logger thread only */
 static pthread_t logger;
 static pthread_attr_t logger_attr;
 
-#include <stdio.h>
+static struct logger_stats stats;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static void *
-do_logging(void *args) {
+const double logger_percentiles[LOGGER_PERCENTILES] = { 50.0, 99.0, 99.9 };
+
+static void
+update_stats(unsigned long records, unsigned long long commit_usec)
+{
+  pthread_mutex_lock(&stats_mutex);
+  stats.batches++;
+  stats.records += records;
+  stats.last_batch = records;
+  if (records > stats.max_batch)
+    stats.max_batch = records;
+  stats.commit_usec += commit_usec;
+  stats.last_commit_usec = commit_usec;
+  if (commit_usec > stats.max_commit_usec)
+    stats.max_commit_usec = commit_usec;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+void
+logger_get_stats(struct logger_stats *s)
+{
+  pthread_mutex_lock(&stats_mutex);
+  *s = stats;
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+/*
+ * Format a request size histogram as "<lowest size>:<count>" pairs, e.g.
+ * "4096:250000 1048576:3" for 250000 requests of 4-8 KiB and three of
+ * 1-2 MiB.  Returns the length, 0 if there were none.
+ */
+int
+logger_format_sizes(char *buf, size_t size, const uint32_t *sizes)
+{
+  int b, len = 0;
+
+  buf[0] = '\0';
+  for (b = 0; b < AP_SIZE_BUCKETS && len < size; b++) {
+    if (sizes[b] == 0)
+      continue;
+    len += snprintf(buf + len, size - len, "%s%llu:%u",
+		    len > 0 ? " " : "",
+		    b == 0 ? 0ULL : 1ULL << (b - 1), sizes[b]);
+  }
+
+  return (len < size ? len : size - 1);
+}
+
+static void
+log_one(struct access_profile *ap)
+{
+  /* deferred caller resolution, see get_caller_path() in monitor.c */
+  if (ap_get_caller_path(ap) == NULL && monfs_config_get_caller_defer())
+    ap_set_caller(ap, ap_get_pid(ap), caller_lookup(ap_get_pid(ap)));
+
+  if (ap_get_r_hist(ap) != NULL)
+    hist_sum_add(&r_latency, ap_get_r_hist(ap));
+  if (ap_get_w_hist(ap) != NULL)
+    hist_sum_add(&w_latency, ap_get_w_hist(ap));
+
+  if (backend->log(ap) != MONFS_OK)
+    monfs_err_msg(MONFS_ERR_LOGGER_WRITE, backend->name);
+}
+
+/*
+ * Group commit: drain whatever is queued, up to log_batch_size profiles
+ * or log_batch_time msec, into a single backend transaction.
+ * Returns the number of profiles logged.
+ */
+static unsigned long
+log_batch(unsigned long batch_size, unsigned long long batch_time)
+{
   int res;
-  char *e, *sql;
   struct access_profile *ap;
-	
-  for (;;) {
-    res = apq_wait();
-    if (res != MONFS_OK)
-      monfs_err_msg(res, NULL);
+  unsigned long n, closes = 0;
+  unsigned long long start, now;
 
-    if (sqlite3_exec(log, "BEGIN", NULL, NULL, &e) != SQLITE_OK)
-      continue;
-    
-    res = apq_dequeue(&ap);
-    if (res != MONFS_OK) {
-      monfs_err_msg(res, NULL);
-      goto commit;
-    }
+  res = apq_dequeue(&ap);
+  if (res != MONFS_OK) {
+    monfs_err_msg(res, NULL);
+    return 0;
+  }
+  if (ap == NULL)
+    return 0; /* empty */
 
-    sql = sqlite3_mprintf("INSERT INTO trace VALUES('%ld', '%ld', '%s', '%s', '%llu', '%ld', '%ld', '%llu', '%ld', '%ld', '%s')", 
-			  ap_get_time_stamp(ap), ap_get_pid(ap), ap_get_caller_path(ap), ap_get_path(ap), 
-    			  ap_get_r_size(ap), ap_get_r_sec(ap), ap_get_r_usec(ap), 
-    			  ap_get_w_size(ap), ap_get_w_sec(ap), ap_get_w_usec(ap), 
-    			  ap_get_hostname(ap));
-    if (sql == NULL) {
-      monfs_err_msg(MONFS_ERR_NO_MEMORY, NULL);
-      goto commit;
-    }
-		
-    if (sqlite3_exec(log, sql, NULL, NULL, &e) != SQLITE_OK)
-      monfs_err_msg(MONFS_ERR_DB_EXEC, NULL);
-
-    sqlite3_free(sql);
-		
-  commit:
-    switch(sqlite3_exec(log, "COMMIT", NULL, NULL, &e)) {
-    case SQLITE_OK:
-      /* do nothing */
+  res = backend->begin();
+  if (res != MONFS_OK) {
+    monfs_err_msg(res, backend->name);
+    counter_add(COUNTER_DROPPED, ap_get_handles(ap));
+    counter_add(COUNTER_LOGGER_DROPPED, ap_get_handles(ap));
+    ap_free(ap);
+    return 0;
+  }
+
+  start = monfs_clock_ns();
+  for (n = 0; ap != NULL; ) {
+    log_one(ap);
+    closes += ap_get_handles(ap);
+    ap_free(ap);
+    n++;
+
+    if (n >= batch_size)
       break;
-    case SQLITE_BUSY:
-      goto commit;
+    if (monfs_clock_ns() - start >= batch_time)
       break;
-    default:
-      monfs_err_msg(MONFS_ERR_DB_EXEC, NULL);
+
+    res = apq_dequeue(&ap);
+    if (res != MONFS_OK) {
+      monfs_err_msg(res, NULL);
       break;
     }
-    ap_free(ap);
   }
-  /* DO NOT REACHED */
+
+  start = monfs_clock_ns();
+  res = backend->commit();
+  if (res != MONFS_OK) {
+    monfs_err_msg(res, backend->name);
+    counter_add(COUNTER_DROPPED, closes); /* rolled back */
+    counter_add(COUNTER_LOGGER_DROPPED, closes);
+  } else {
+    counter_add(COUNTER_LOGGED, closes);
+  }
+  now = monfs_clock_ns();
+  update_stats(res == MONFS_OK ? n : 0, (now - start) / 1000);
+
+  /* give the freed profiles back to their threads */
+  pool_flush();
+
+  return n;
 }
 
-static int
-db_init(const char *db_path) {
-  char *e, *sql;
+/* write the operation counts of the last interval in a transaction */
+static void
+log_ops()
+{
+  struct opstat_snapshot *s;
+  unsigned long i;
   int res;
 
-  /** FIXME **/
-  unlink(db_path);
-	
-  if (log != NULL)
-    return MONFS_ERR_DB_INIT;
-	
-  if (sqlite3_open(db_path, &log) != SQLITE_OK)
-    return MONFS_ERR_DB_OPEN;
-	
-  sql = sqlite3_mprintf("CREATE TABLE trace (time_stamp, pid, caller_path, path, r_size, r_sec, r_usec, w_size, w_sec, w_usec, hostname)");
-  if (sql == NULL) {
-    res = MONFS_ERR_NO_MEMORY;
-    goto error;
-  }
-	
-  if (sqlite3_exec(log, sql, NULL, NULL, &e) == SQLITE_OK) 
-    res = MONFS_OK;
-  else
-    res = MONFS_ERR_DB_EXEC;
+  s = opstat_snapshot();
+  if (s == NULL)
+    return;
 
-  sqlite3_free(sql);
+  for (i = 0; i < s->ncallers; i++)
+    s->callers[i].caller_path = caller_lookup(s->callers[i].pid);
 
+  res = backend->begin();
+  if (res == MONFS_OK) {
+    res = backend->log_ops(s);
+    if (backend->commit() != MONFS_OK && res == MONFS_OK)
+      res = MONFS_ERR_LOGGER_WRITE;
+  }
   if (res != MONFS_OK)
-    goto error;
-	
-  return MONFS_OK;
-	
- error:
-  sqlite3_close(log);
-  return res;
+    monfs_err_msg(res, backend->name);
+
+  for (i = 0; i < s->ncallers; i++) {
+    str_release(s->callers[i].caller_path);
+    s->callers[i].caller_path = NULL;
+  }
 }
 
-static void
-db_destroy() {
-  if (log == NULL)
-    return;
-	
-  sqlite3_close(log);
-  log = NULL;
+static void *
+do_logging(void *args) {
+  int res, closed;
+  unsigned long batch_size;
+  unsigned long long batch_time, ops_interval, ops_next = 0, now;
+  long timeout = -1;
+
+  batch_size = monfs_config_get_log_batch_size();
+  batch_time = monfs_config_get_log_batch_time() * 1000000ULL;
+  ops_interval = monfs_config_get_op_stats_interval() * 1000000000ULL;
+  if (opstat_enabled)
+    ops_next = monfs_clock_ns() + ops_interval;
+
+  for (;;) {
+    if (opstat_enabled) {
+      now = monfs_clock_ns();
+      if (now >= ops_next) {
+	log_ops();
+	ops_next = now + ops_interval;
+      }
+      timeout = (ops_next - now) / 1000000 + 1;
+    }
+
+    apq_update_sampling();
+
+    /* checked before draining so that nothing queued before close is lost */
+    closed = apq_is_closed();
+
+    if (log_batch(batch_size, batch_time) > 0)
+      continue;
+
+    if (closed)
+      break;
+
+    if (backend->idle != NULL && backend->idle() > 0)
+      continue;
+    if (backend->idle != NULL && (timeout < 0 || timeout > 1000))
+      timeout = 1000; /* keep calling idle() while nothing is logged */
+
+    res = apq_wait(timeout);
+    if (res != MONFS_OK)
+      monfs_err_msg(res, NULL);
+  }
+
+  return NULL;
 }
 
 int
@@ -141,15 +270,37 @@ log_ap(struct access_profile *ap)
   return apq_enqueue(ap);
 }
 
+static const struct logger_backend *
+find_backend(const char *name)
+{
+  const struct logger_backend **b;
+
+  for (b = backends; *b != NULL; b++) {
+    if (strcmp((*b)->name, name) == 0)
+      return *b;
+  }
+
+  return NULL;
+}
+
 int
-start_logger(const char *db_path)
+start_logger(const char *path)
 {
   int res;
 
-  res = db_init(db_path);
+  backend = find_backend(monfs_config_get_logger());
+  if (backend == NULL) {
+    monfs_err_msg(MONFS_ERR_CONF_PARSE, monfs_config_get_logger());
+    return MONFS_ERR_LOGGER_INIT;
+  }
+
+  res = backend->init(path);
   if (res != MONFS_OK)
     return res;
 
+  hist_sum_clear(&r_latency);
+  hist_sum_clear(&w_latency);
+
   res = apq_init();
   if (res != MONFS_OK)
     goto apq_init_error;
@@ -160,13 +311,7 @@ start_logger(const char *db_path)
     goto thread_attr_init_error;
   }
 
-  res = pthread_attr_setdetachstate(&logger_attr, PTHREAD_CREATE_DETACHED);
-  if (res != 0) {
-    res = MONFS_ERR_LOGGER_INIT;
-    goto thread_error;
-  }
-
-  res = pthread_create(&logger, NULL, do_logging, NULL);
+  res = pthread_create(&logger, &logger_attr, do_logging, NULL);
   if (res != 0) {
     res = MONFS_ERR_LOGGER_INIT;
     goto thread_error;
@@ -179,15 +324,69 @@ start_logger(const char *db_path)
  thread_attr_init_error:
   apq_destroy();
  apq_init_error:
-  db_destroy();
+  backend->destroy();
   return res;
 }
 
+static void
+report_stats()
+{
+  char buf[256];
+  struct logger_stats s;
+
+  logger_get_stats(&s);
+  if (s.batches == 0)
+    return;
+
+  snprintf(buf, sizeof(buf),
+	   "logger : %llu records in %llu batches (avg %llu, max %lu), "
+	   "commit avg %llu usec, max %llu usec",
+	   s.records, s.batches, s.records / s.batches, s.max_batch,
+	   s.commit_usec / s.batches, s.max_commit_usec);
+  monfs_msg(buf);
+}
+
+static void
+report_latency(const char *op, const struct hist_sum *sum)
+{
+  char buf[256];
+  unsigned long long v[LOGGER_PERCENTILES];
+
+  if (sum->total == 0)
+    return;
+
+  hist_sum_percentiles(sum, logger_percentiles, v, LOGGER_PERCENTILES);
+  snprintf(buf, sizeof(buf),
+	   "%s latency : %llu ops, p50 %llu nsec, p99 %llu nsec, "
+	   "p999 %llu nsec, max %llu nsec",
+	   op, sum->total, v[0], v[1], v[2], sum->max);
+  monfs_msg(buf);
+}
+
 void
 stop_logger()
 {
-  pthread_cancel(logger);
+  int res;
+
+  apq_close();
+  pthread_join(logger, NULL);
   pthread_attr_destroy(&logger_attr);
+  report_stats();
+
+  /* the logger thread is gone, the backend is ours now */
+  if (opstat_enabled)
+    log_ops();
+  report_latency("read", &r_latency);
+  report_latency("write", &w_latency);
+  if (backend->begin() == MONFS_OK) {
+    res = backend->save_latency("read", &r_latency);
+    if (res == MONFS_OK)
+      res = backend->save_latency("write", &w_latency);
+    if (res != MONFS_OK)
+      monfs_err_msg(res, backend->name);
+    backend->commit();
+  }
+
   apq_destroy();
-  db_destroy();
+  backend->destroy();
 }
@@ -25,8 +25,19 @@
 
 struct access_profile;
 
+struct logger_stats {
+  unsigned long long batches;
+  unsigned long long records;
+  unsigned long last_batch;
+  unsigned long max_batch;
+  unsigned long long commit_usec; /* total */
+  unsigned long long last_commit_usec;
+  unsigned long long max_commit_usec;
+};
+
 int start_logger(const char *);
 void stop_logger();
 int log_ap(struct access_profile *);
+void logger_get_stats(struct logger_stats *);
 
 #endif /* LOGGER_H_ */
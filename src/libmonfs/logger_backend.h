@@ -0,0 +1,65 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef LOGGER_BACKEND_H_
+#define LOGGER_BACKEND_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct access_profile;
+struct hist_sum;
+struct opstat_snapshot;
+
+/*
+ * Where the logger thread writes closed profiles.  A batch is
+ * begin(), log() per profile, then commit().  Also between begin() and
+ * commit(), log_ops() gets the operation counts once per
+ * op_stats_interval and save_latency() the read and write histograms
+ * at unmount.  idle(), if set, is called whenever the queue is empty,
+ * and at least once a second while it stays so, and may do one piece
+ * of deferred work; it returns 1 if it did, 0 if there is nothing to
+ * do.  All calls come from a single thread.
+ */
+struct logger_backend {
+  const char *name;
+  int (*init)(const char *path);
+  void (*destroy)();
+  int (*begin)();
+  int (*log)(struct access_profile *);
+  int (*commit)();
+  int (*save_latency)(const char *op, const struct hist_sum *);
+  int (*log_ops)(const struct opstat_snapshot *);
+  int (*idle)();
+};
+
+extern const struct logger_backend sqlite_logger;
+extern const struct logger_backend file_logger;
+extern const struct logger_backend null_logger;
+
+/* latency summary of a handle: p50, p99, p999, then max */
+#define LOGGER_PERCENTILES 3
+extern const double logger_percentiles[LOGGER_PERCENTILES];
+
+int logger_format_sizes(char *, size_t, const uint32_t *);
+
+#endif /* LOGGER_BACKEND_H_ */
@@ -0,0 +1,320 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+/*
+ * Line protocol logger: one line per closed handle, appended to a plain
+ * file and buffered in memory between batches.
+ *
+ *   monfs,host=node1 pid=42i,caller="/bin/cp",path="/a/b",...,w_ops=0i 1290000000000000000
+ *
+ * The timestamp is open_ns.  Operation counts are monfs_op lines, one
+ * per op and interval, and with op_stats_callers one more per op and
+ * pid.  Latency histograms are appended at unmount as monfs_latency
+ * lines, one per non empty bucket.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <monfs.h>
+#include "access_profile.h"
+#include "logger_backend.h"
+#include "hist.h"
+#include "opstat.h"
+
+#define FILE_LOGGER_BUFSIZE (1 << 20)
+
+static FILE *out = NULL;
+static char *out_buf = NULL;
+static char hostname[256];
+
+/* escape a tag value: commas, spaces and equal signs */
+static void
+put_tag(const char *str)
+{
+  for (; *str != '\0'; str++) {
+    if (*str == ',' || *str == ' ' || *str == '=')
+      putc('\\', out);
+    putc(*str, out);
+  }
+}
+
+/* a quoted string field, newlines escaped to keep one record per line */
+static void
+put_string(const char *name, const char *str)
+{
+  if (str == NULL)
+    return;
+
+  fprintf(out, ",%s=\"", name);
+  for (; *str != '\0'; str++) {
+    if (*str == '\n') {
+      fputs("\\n", out);
+      continue;
+    }
+    if (*str == '"' || *str == '\\')
+      putc('\\', out);
+    putc(*str, out);
+  }
+  putc('"', out);
+}
+
+static void
+put_int(const char *name, long long v)
+{
+  fprintf(out, ",%s=%lldi", name, v);
+}
+
+static void
+put_latency(const char *prefix, const struct hist *h)
+{
+  static const char *names[LOGGER_PERCENTILES] = { "p50_ns", "p99_ns", "p999_ns" };
+  unsigned long long v[LOGGER_PERCENTILES];
+  char name[32];
+  int k;
+
+  if (h == NULL)
+    return;
+
+  hist_percentiles(h, logger_percentiles, v, LOGGER_PERCENTILES);
+  for (k = 0; k < LOGGER_PERCENTILES; k++) {
+    snprintf(name, sizeof(name), "%s_%s", prefix, names[k]);
+    put_int(name, v[k]);
+  }
+  snprintf(name, sizeof(name), "%s_max_ns", prefix);
+  put_int(name, h->max);
+}
+
+static void
+put_sizes(const char *name, const uint32_t *sizes)
+{
+  char buf[AP_SIZE_BUCKETS * 32];
+
+  if (logger_format_sizes(buf, sizeof(buf), sizes) > 0)
+    put_string(name, buf);
+}
+
+static int
+file_init(const char *path)
+{
+  if (out != NULL)
+    return MONFS_ERR_LOGGER_INIT;
+
+  if (gethostname(hostname, sizeof(hostname)) != 0)
+    hostname[0] = '\0';
+  hostname[sizeof(hostname) - 1] = '\0';
+
+  out = fopen(path, "a");
+  if (out == NULL)
+    return MONFS_ERR_LOGGER_INIT;
+
+  out_buf = malloc(FILE_LOGGER_BUFSIZE);
+  if (out_buf != NULL)
+    setvbuf(out, out_buf, _IOFBF, FILE_LOGGER_BUFSIZE);
+
+  return MONFS_OK;
+}
+
+static void
+file_destroy()
+{
+  if (out == NULL)
+    return;
+
+  fclose(out);
+  out = NULL;
+  free(out_buf);
+  out_buf = NULL;
+}
+
+static int
+file_begin()
+{
+  return MONFS_OK;
+}
+
+static int
+file_log(struct access_profile *ap)
+{
+  char name[32];
+  int i;
+
+  fputs("monfs", out);
+  if (ap_get_hostname(ap) != NULL) {
+    fputs(",host=", out);
+    put_tag(ap_get_hostname(ap));
+  }
+  fprintf(out, " pid=%di", (int)ap_get_pid(ap));
+  put_string("caller", ap_get_caller_path(ap));
+  put_string("path", ap_get_path(ap));
+  put_int("close_ns", ap_get_close_time(ap));
+  put_int("duration_ns", ap_get_duration(ap));
+  put_int("blksize", ap_get_blksize(ap));
+
+  put_int("r_size", ap_get_r_size(ap));
+  put_int("r_nsec", ap_get_r_nsec(ap));
+  put_int("r_ops", ap_get_r_ops(ap));
+  put_int("r_unaligned_4k", ap_get_r_unaligned_4k(ap));
+  put_int("r_unaligned_blk", ap_get_r_unaligned_blk(ap));
+  put_sizes("r_sizes", ap_get_r_sizes(ap));
+  put_latency("r", ap_get_r_hist(ap));
+  put_int("r_seq", ap_get_r_pattern(ap, AP_SEQUENTIAL));
+  put_int("r_strided", ap_get_r_pattern(ap, AP_STRIDED));
+  put_int("r_backward", ap_get_r_pattern(ap, AP_BACKWARD));
+  put_int("r_random", ap_get_r_pattern(ap, AP_RANDOM));
+  put_int("r_stride", ap_get_r_stride(ap));
+  put_int("r_seek_bytes", ap_get_r_seek(ap));
+
+  put_int("w_size", ap_get_w_size(ap));
+  put_int("w_nsec", ap_get_w_nsec(ap));
+  put_int("w_ops", ap_get_w_ops(ap));
+  put_int("w_unaligned_4k", ap_get_w_unaligned_4k(ap));
+  put_int("w_unaligned_blk", ap_get_w_unaligned_blk(ap));
+  put_sizes("w_sizes", ap_get_w_sizes(ap));
+  put_latency("w", ap_get_w_hist(ap));
+  put_int("w_seq", ap_get_w_pattern(ap, AP_SEQUENTIAL));
+  put_int("w_strided", ap_get_w_pattern(ap, AP_STRIDED));
+  put_int("w_backward", ap_get_w_pattern(ap, AP_BACKWARD));
+  put_int("w_random", ap_get_w_pattern(ap, AP_RANDOM));
+  put_int("w_stride", ap_get_w_stride(ap));
+  put_int("w_seek_bytes", ap_get_w_seek(ap));
+
+  for (i = 0; i < MONFS_SYNCS; i++) {
+    if (ap_get_sync_ops(ap, i) == 0)
+      continue;
+    snprintf(name, sizeof(name), "%s_ops", ap_sync_name(i));
+    put_int(name, ap_get_sync_ops(ap, i));
+    snprintf(name, sizeof(name), "%s_nsec", ap_sync_name(i));
+    put_int(name, ap_get_sync_nsec(ap, i));
+    snprintf(name, sizeof(name), "%s_max_ns", ap_sync_name(i));
+    put_int(name, ap_get_sync_max(ap, i));
+  }
+  put_int("sync_bytes", ap_get_synced(ap));
+  put_int("sync_bytes_max", ap_get_synced_max(ap));
+  put_sizes("sync_sizes", ap_get_synced_sizes(ap));
+  put_int("unsynced_bytes", ap_get_unsynced(ap));
+  if (ap_get_handles(ap) > 1)
+    put_int("handles", ap_get_handles(ap));
+
+  fprintf(out, " %llu\n", ap_get_open_time(ap));
+
+  return (ferror(out) ? MONFS_ERR_LOGGER_WRITE : MONFS_OK);
+}
+
+static int
+file_commit()
+{
+  if (fflush(out) != 0 || ferror(out)) {
+    clearerr(out);
+    return MONFS_ERR_LOGGER_WRITE;
+  }
+
+  return MONFS_OK;
+}
+
+static int
+file_save_latency(const char *op, const struct hist_sum *sum)
+{
+  struct timespec now;
+  int i;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    if (sum->counts[i] == 0)
+      continue;
+    fputs("monfs_latency", out);
+    if (hostname[0] != '\0') {
+      fputs(",host=", out);
+      put_tag(hostname);
+    }
+    fprintf(out, ",op=%s lo_ns=%llui,hi_ns=%llui,count=%llui %llu\n", op,
+	    (unsigned long long)hist_bucket_low(i),
+	    (unsigned long long)hist_bucket_high(i),
+	    (unsigned long long)sum->counts[i],
+	    now.tv_sec * 1000000000ULL + now.tv_nsec);
+  }
+
+  return (ferror(out) ? MONFS_ERR_LOGGER_WRITE : MONFS_OK);
+}
+
+static void
+put_op(const struct opstat_snapshot *s, int op, const struct op_count *c,
+       const struct opstat_caller *caller)
+{
+  unsigned long long v[LOGGER_PERCENTILES];
+
+  fputs("monfs_op", out);
+  if (hostname[0] != '\0') {
+    fputs(",host=", out);
+    put_tag(hostname);
+  }
+  fprintf(out, ",op=%s count=%llui", opstat_name(op), c->count);
+  put_int("errors", c->errors);
+  put_int("nsec", c->nsec);
+  put_int("interval_ns", s->interval);
+  if (caller != NULL) {
+    put_int("pid", caller->pid);
+    put_string("caller", caller->caller_path);
+  } else {
+    hist_sum_percentiles(&(s->hist[op]), logger_percentiles, v,
+			 LOGGER_PERCENTILES);
+    put_int("p50_ns", v[0]);
+    put_int("p99_ns", v[1]);
+    put_int("p999_ns", v[2]);
+    put_int("max_ns", s->hist[op].max);
+  }
+  fprintf(out, " %llu\n", s->time);
+}
+
+static int
+file_log_ops(const struct opstat_snapshot *s)
+{
+  unsigned long i;
+  int op;
+
+  for (op = 0; op < MONFS_OPS; op++) {
+    if (s->ops[op].count > 0)
+      put_op(s, op, &(s->ops[op]), NULL);
+  }
+
+  for (i = 0; i < s->ncallers; i++) {
+    for (op = 0; op < MONFS_OPS; op++) {
+      if (s->callers[i].ops[op].count > 0)
+	put_op(s, op, &(s->callers[i].ops[op]), &(s->callers[i]));
+    }
+  }
+
+  return (ferror(out) ? MONFS_ERR_LOGGER_WRITE : MONFS_OK);
+}
+
+const struct logger_backend file_logger = {
+  "file",
+  file_init,
+  file_destroy,
+  file_begin,
+  file_log,
+  file_commit,
+  file_save_latency,
+  file_log_ops,
+  NULL
+};
@@ -0,0 +1,77 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+/*
+ * Drops every profile.  Monitoring, the queue and the latency summary
+ * at unmount still run, so this measures monfs without the cost of
+ * storing anything.
+ */
+
+#include <monfs.h>
+#include "logger_backend.h"
+
+static int
+null_init(const char *path)
+{
+  return MONFS_OK;
+}
+
+static void
+null_destroy()
+{
+}
+
+static int
+null_ok()
+{
+  return MONFS_OK;
+}
+
+static int
+null_log(struct access_profile *ap)
+{
+  return MONFS_OK;
+}
+
+static int
+null_save_latency(const char *op, const struct hist_sum *sum)
+{
+  return MONFS_OK;
+}
+
+static int
+null_log_ops(const struct opstat_snapshot *s)
+{
+  return MONFS_OK;
+}
+
+const struct logger_backend null_logger = {
+  "null",
+  null_init,
+  null_destroy,
+  null_ok,
+  null_log,
+  null_ok,
+  null_save_latency,
+  null_log_ops,
+  NULL
+};
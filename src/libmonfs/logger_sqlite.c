@@ -0,0 +1,1288 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <monfs.h>
+#include "access_profile.h"
+#include "logger_backend.h"
+#include "strtab.h"
+#include "hist.h"
+#include "opstat.h"
+#include "clock.h"
+#include "error.h"
+#include "config.h"
+
+
+static sqlite3 *log = NULL;
+static sqlite3_stmt *insert_stmt = NULL;
+static sqlite3_stmt *string_insert_stmt = NULL;
+static sqlite3_stmt *string_select_stmt = NULL;
+static sqlite3_stmt *ops_stmt = NULL;
+static unsigned long db_gen = 1; /* invalidates ids cached in strtab */
+static unsigned long long mount_ns; /* since the epoch */
+
+/* rotation of the live database, see db_rotate() */
+static char *db_file = NULL;
+static unsigned long long segment_start, segment_end; /* since the epoch */
+static unsigned long long rotate_ns, rotate_bytes, retention_ns;
+
+/*
+ * <db_path>.lock, read locked by every mount logging to db_path for as
+ * long as it does.  A mount still holding a sealed segment open would
+ * take the rollback journal of the new db_path, which has the same name,
+ * for a hot one and play it back into the segment; so db_rotate() only
+ * seals a database that no other mount shares, and otherwise leaves it
+ * to grow.
+ */
+static int mount_lock = -1;
+static int mount_shared = 0; /* reported once */
+
+/*
+ * db_staging: off commits to db_path with a rollback journal and full
+ * fsyncs.  wal commits to it in WAL mode with synchronous = NORMAL, so
+ * that a commit is not synced until the next checkpoint.  memory commits
+ * to an in-memory database that holds only the rows since the last
+ * flush, which appends them to db_path every db_backup_interval, before
+ * rotation and at unmount; up to that many seconds of trace are lost if
+ * monfs dies.  As a flush only adds rows, mounts sharing db_path keep
+ * each other's.
+ */
+enum {
+  DB_STAGING_OFF,
+  DB_STAGING_WAL,
+  DB_STAGING_MEMORY
+};
+
+static int staging = DB_STAGING_OFF;
+static int dirty = 0; /* committed since the last flush */
+static unsigned long long backup_ns, backup_next;
+
+static int db_rotate();
+
+/*
+ * Paths, executables and hostnames are stored once in the strings table
+ * and referenced by id from trace_log.  The id of an interned string is
+ * cached in strtab, so only the first row with a new string pays for the
+ * dictionary lookup.
+ */
+static long long
+db_string_id(const char *str)
+{
+  long long id;
+  int res;
+
+  if (str == NULL)
+    return 0;
+
+  id = str_get_id(str, db_gen);
+  if (id != 0)
+    return id;
+
+  sqlite3_bind_text(string_insert_stmt, 1, str, -1, SQLITE_STATIC);
+  res = sqlite3_step(string_insert_stmt);
+  sqlite3_reset(string_insert_stmt);
+  if (res != SQLITE_DONE)
+    return 0;
+
+  if (sqlite3_changes(log) > 0) {
+    id = sqlite3_last_insert_rowid(log);
+  } else {
+    sqlite3_bind_text(string_select_stmt, 1, str, -1, SQLITE_STATIC);
+    if (sqlite3_step(string_select_stmt) == SQLITE_ROW)
+      id = sqlite3_column_int64(string_select_stmt, 0);
+    sqlite3_reset(string_select_stmt);
+  }
+
+  if (id != 0)
+    str_set_id(str, db_gen, id);
+
+  return id;
+}
+
+static void
+bind_id(sqlite3_stmt *stmt, int i, long long id)
+{
+  if (id == 0)
+    sqlite3_bind_null(stmt, i);
+  else
+    sqlite3_bind_int64(stmt, i, id);
+}
+
+/* bind p50, p99, p999 and max of a handle's latencies from column i on */
+static void
+bind_latency(sqlite3_stmt *stmt, int i, const struct hist *h)
+{
+  unsigned long long v[LOGGER_PERCENTILES];
+  int k;
+
+  if (h == NULL) {
+    for (k = 0; k <= LOGGER_PERCENTILES; k++)
+      sqlite3_bind_null(stmt, i + k);
+    return;
+  }
+
+  hist_percentiles(h, logger_percentiles, v, LOGGER_PERCENTILES);
+  for (k = 0; k < LOGGER_PERCENTILES; k++)
+    sqlite3_bind_int64(stmt, i + k, v[k]);
+  sqlite3_bind_int64(stmt, i + k, h->max);
+}
+
+static void
+bind_sizes(sqlite3_stmt *stmt, int i, const uint32_t *sizes)
+{
+  char buf[AP_SIZE_BUCKETS * 32];
+  int len;
+
+  len = logger_format_sizes(buf, sizeof(buf), sizes);
+  if (len == 0)
+    sqlite3_bind_null(stmt, i);
+  else
+    sqlite3_bind_text(stmt, i, buf, len, SQLITE_TRANSIENT);
+}
+
+static int
+db_insert(struct access_profile *ap)
+{
+  int i, res;
+
+  sqlite3_bind_int64(insert_stmt, 1, ap_get_open_time(ap));
+  sqlite3_bind_int64(insert_stmt, 2, ap_get_close_time(ap));
+  sqlite3_bind_int64(insert_stmt, 3, ap_get_duration(ap));
+  sqlite3_bind_int64(insert_stmt, 4, ap_get_pid(ap));
+  bind_id(insert_stmt, 5, db_string_id(ap_get_caller_path(ap)));
+  bind_id(insert_stmt, 6, db_string_id(ap_get_path(ap)));
+  sqlite3_bind_int64(insert_stmt, 7, ap_get_r_size(ap));
+  sqlite3_bind_int64(insert_stmt, 8, ap_get_r_nsec(ap));
+  sqlite3_bind_int64(insert_stmt, 9, ap_get_w_size(ap));
+  sqlite3_bind_int64(insert_stmt, 10, ap_get_w_nsec(ap));
+  bind_id(insert_stmt, 11, db_string_id(ap_get_hostname(ap)));
+  bind_latency(insert_stmt, 12, ap_get_r_hist(ap));
+  bind_latency(insert_stmt, 16, ap_get_w_hist(ap));
+  sqlite3_bind_int64(insert_stmt, 20, ap_get_blksize(ap));
+  sqlite3_bind_int64(insert_stmt, 21, ap_get_r_ops(ap));
+  sqlite3_bind_int64(insert_stmt, 22, ap_get_r_unaligned_4k(ap));
+  sqlite3_bind_int64(insert_stmt, 23, ap_get_r_unaligned_blk(ap));
+  bind_sizes(insert_stmt, 24, ap_get_r_sizes(ap));
+  sqlite3_bind_int64(insert_stmt, 25, ap_get_w_ops(ap));
+  sqlite3_bind_int64(insert_stmt, 26, ap_get_w_unaligned_4k(ap));
+  sqlite3_bind_int64(insert_stmt, 27, ap_get_w_unaligned_blk(ap));
+  bind_sizes(insert_stmt, 28, ap_get_w_sizes(ap));
+  sqlite3_bind_int64(insert_stmt, 29, ap_get_r_pattern(ap, AP_SEQUENTIAL));
+  sqlite3_bind_int64(insert_stmt, 30, ap_get_r_pattern(ap, AP_STRIDED));
+  sqlite3_bind_int64(insert_stmt, 31, ap_get_r_pattern(ap, AP_BACKWARD));
+  sqlite3_bind_int64(insert_stmt, 32, ap_get_r_pattern(ap, AP_RANDOM));
+  sqlite3_bind_int64(insert_stmt, 33, ap_get_r_stride(ap));
+  sqlite3_bind_int64(insert_stmt, 34, ap_get_r_seek(ap));
+  sqlite3_bind_int64(insert_stmt, 35, ap_get_w_pattern(ap, AP_SEQUENTIAL));
+  sqlite3_bind_int64(insert_stmt, 36, ap_get_w_pattern(ap, AP_STRIDED));
+  sqlite3_bind_int64(insert_stmt, 37, ap_get_w_pattern(ap, AP_BACKWARD));
+  sqlite3_bind_int64(insert_stmt, 38, ap_get_w_pattern(ap, AP_RANDOM));
+  sqlite3_bind_int64(insert_stmt, 39, ap_get_w_stride(ap));
+  sqlite3_bind_int64(insert_stmt, 40, ap_get_w_seek(ap));
+  for (i = 0; i < MONFS_SYNCS; i++) {
+    sqlite3_bind_int64(insert_stmt, 41 + 3 * i, ap_get_sync_ops(ap, i));
+    sqlite3_bind_int64(insert_stmt, 42 + 3 * i, ap_get_sync_nsec(ap, i));
+    sqlite3_bind_int64(insert_stmt, 43 + 3 * i, ap_get_sync_max(ap, i));
+  }
+  sqlite3_bind_int64(insert_stmt, 53, ap_get_synced(ap));
+  sqlite3_bind_int64(insert_stmt, 54, ap_get_synced_max(ap));
+  bind_sizes(insert_stmt, 55, ap_get_synced_sizes(ap));
+  sqlite3_bind_int64(insert_stmt, 56, ap_get_unsynced(ap));
+  sqlite3_bind_int64(insert_stmt, 57, ap_get_handles(ap));
+
+  res = sqlite3_step(insert_stmt);
+  sqlite3_reset(insert_stmt);
+
+  return (res == SQLITE_DONE ? MONFS_OK : MONFS_ERR_DB_EXEC);
+}
+
+/*
+ * While another process holds the database, retry with exponential
+ * backoff rather than spin; the queue overflow policy takes care of the
+ * profiles closed meanwhile.  Gives up after DB_BUSY_TIMEOUT.
+ */
+#define DB_BUSY_DELAY_MIN 1000		/* usec */
+#define DB_BUSY_DELAY_MAX 100000	/* usec */
+#define DB_BUSY_TIMEOUT 10000000ULL	/* usec */
+
+static int
+db_exec_busy(const char *sql)
+{
+  unsigned long delay = DB_BUSY_DELAY_MIN;
+  unsigned long long waited = 0;
+  int res;
+
+  for (;;) {
+    res = sqlite3_exec(log, sql, NULL, NULL, NULL);
+    if (res != SQLITE_BUSY || waited >= DB_BUSY_TIMEOUT)
+      return res;
+    usleep(delay);
+    waited += delay;
+    delay = (delay * 2 < DB_BUSY_DELAY_MAX ? delay * 2 : DB_BUSY_DELAY_MAX);
+  }
+}
+
+/*
+ * Take the write lock up front, so that only BEGIN and COMMIT may find
+ * the database busy and the inserts in between never do.
+ */
+static int
+db_begin()
+{
+  db_rotate();
+
+  if (db_exec_busy("BEGIN IMMEDIATE") != SQLITE_OK)
+    return MONFS_ERR_DB_EXEC;
+
+  return MONFS_OK;
+}
+
+static int
+db_commit()
+{
+  if (db_exec_busy("COMMIT") != SQLITE_OK) {
+    sqlite3_exec(log, "ROLLBACK", NULL, NULL, NULL);
+    db_gen++; /* string ids of this batch may have been rolled back */
+    return MONFS_ERR_DB_EXEC;
+  }
+
+  return MONFS_OK;
+}
+
+/* count, time and slowest call of each MONFS_SYNC_* in order */
+#define SYNC_COLUMNS							\
+  "fsync_ops, fsync_nsec, fsync_max_ns, "				\
+  "fdatasync_ops, fdatasync_nsec, fdatasync_max_ns, "			\
+  "flush_ops, flush_nsec, flush_max_ns, "				\
+  "ftruncate_ops, ftruncate_nsec, ftruncate_max_ns, "			\
+  "sync_bytes, sync_bytes_max, sync_sizes, unsynced_bytes"
+
+/* the dominant access pattern of a handle */
+#define PATTERN(d)							\
+  "CASE WHEN " d "_ops = 0 THEN NULL "					\
+  "WHEN " d "_seq >= max(" d "_strided, " d "_backward, " d "_random) THEN 'sequential' " \
+  "WHEN " d "_strided >= max(" d "_backward, " d "_random) THEN 'strided' " \
+  "WHEN " d "_backward >= " d "_random THEN 'backward' "		\
+  "ELSE 'random' END"
+
+/*
+ * The layout of the database.  Bump DB_SCHEMA_VERSION whenever it
+ * changes; a database of another version is moved aside on mount and a
+ * new one started.  Version 1 was the untyped layout without meta.
+ */
+#define DB_SCHEMA_VERSION 2
+
+#define I " INTEGER, "
+
+static const char *db_schema[] = {
+  "CREATE TABLE IF NOT EXISTS meta (key TEXT PRIMARY KEY, value)",
+  "CREATE TABLE IF NOT EXISTS strings (id INTEGER PRIMARY KEY, str TEXT NOT NULL UNIQUE)",
+  /* times in nsec; open_ns and close_ns since the epoch */
+  "CREATE TABLE IF NOT EXISTS trace_log (open_ns" I "close_ns" I "duration_ns" I
+  "pid" I "caller_id" I "path_id" I "r_size" I "r_nsec" I "w_size" I "w_nsec" I
+  "host_id" I
+  "r_p50_ns" I "r_p99_ns" I "r_p999_ns" I "r_max_ns" I
+  "w_p50_ns" I "w_p99_ns" I "w_p999_ns" I "w_max_ns" I
+  "blksize" I "r_ops" I "r_unaligned_4k" I "r_unaligned_blk" I "r_sizes TEXT, "
+  "w_ops" I "w_unaligned_4k" I "w_unaligned_blk" I "w_sizes TEXT, "
+  "r_seq" I "r_strided" I "r_backward" I "r_random" I "r_stride" I "r_seek_bytes" I
+  "w_seq" I "w_strided" I "w_backward" I "w_random" I "w_stride" I "w_seek_bytes" I
+  /*
+   * sync_bytes: bytes written before an fsync or fdatasync, in total,
+   * at most and by power of two per call; unsynced_bytes: written
+   * after the last one
+   */
+  "fsync_ops" I "fsync_nsec" I "fsync_max_ns" I
+  "fdatasync_ops" I "fdatasync_nsec" I "fdatasync_max_ns" I
+  "flush_ops" I "flush_nsec" I "flush_max_ns" I
+  "ftruncate_ops" I "ftruncate_nsec" I "ftruncate_max_ns" I
+  "sync_bytes" I "sync_bytes_max" I "sync_sizes TEXT, unsynced_bytes" I
+  /* > 1 for a summary of handles folded on queue overflow */
+  "handles INTEGER)",
+  /*
+   * the original layout of trace, with the strings resolved, then the
+   * nsec columns; filter on open_ns rather than time_stamp to use the
+   * indexes
+   */
+  "CREATE VIEW IF NOT EXISTS trace AS SELECT open_ns / 1000000000 AS time_stamp, pid, "
+  "c.str AS caller_path, p.str AS path, "
+  "r_size, r_nsec / 1000000000 AS r_sec, r_nsec / 1000 % 1000000 AS r_usec, "
+  "w_size, w_nsec / 1000000000 AS w_sec, w_nsec / 1000 % 1000000 AS w_usec, "
+  "h.str AS hostname, open_ns, close_ns, duration_ns, r_nsec, w_nsec, "
+  "r_p50_ns, r_p99_ns, r_p999_ns, r_max_ns, w_p50_ns, w_p99_ns, w_p999_ns, w_max_ns, "
+  "blksize, r_ops, r_sizes, "
+  "CAST(r_unaligned_4k AS REAL) / r_ops AS r_unaligned_4k_frac, "
+  "CAST(r_unaligned_blk AS REAL) / r_ops AS r_unaligned_blk_frac, "
+  "w_ops, w_sizes, "
+  "CAST(w_unaligned_4k AS REAL) / w_ops AS w_unaligned_4k_frac, "
+  "CAST(w_unaligned_blk AS REAL) / w_ops AS w_unaligned_blk_frac, "
+  "r_seq, r_strided, r_backward, r_random, r_stride, r_seek_bytes, "
+  PATTERN("r") " AS r_pattern, "
+  "w_seq, w_strided, w_backward, w_random, w_stride, w_seek_bytes, "
+  PATTERN("w") " AS w_pattern, " SYNC_COLUMNS ", handles FROM trace_log "
+  "LEFT JOIN strings c ON c.id = caller_id "
+  "LEFT JOIN strings p ON p.id = path_id "
+  "LEFT JOIN strings h ON h.id = host_id",
+  /* latency histograms, written at unmount; mount_ns since the epoch */
+  "CREATE TABLE IF NOT EXISTS latency (mount_ns" I "op TEXT, lo_ns" I "hi_ns" I
+  "count INTEGER)",
+  /*
+   * file system operations per op_stats_interval: one row per op with
+   * pid NULL, then one per op and pid with op_stats_callers
+   */
+  "CREATE TABLE IF NOT EXISTS op_stats (time_ns" I "interval_ns" I "op TEXT, "
+  "pid" I "caller_id" I "count" I "errors" I "nsec" I
+  "p50_ns" I "p99_ns" I "p999_ns" I "max_ns INTEGER)",
+  "CREATE VIEW IF NOT EXISTS ops AS SELECT time_ns, interval_ns, op, pid, c.str AS caller_path, "
+  "count, errors, nsec, p50_ns, p99_ns, p999_ns, max_ns FROM op_stats "
+  "LEFT JOIN strings c ON c.id = caller_id",
+  NULL
+};
+
+#undef I
+
+/*
+ * Built by the compactor thread on its own connection, in the live
+ * database after mount and after each rotation and in every sealed
+ * segment, so that neither the mount nor the logger thread spends its
+ * time on an index over a large database.  The logger may still wait
+ * for the write lock while one is built; a fresh segment has none to
+ * speak of.
+ */
+static const char *db_indexes[] = {
+  "CREATE INDEX IF NOT EXISTS trace_log_open ON trace_log (open_ns)",
+  "CREATE INDEX IF NOT EXISTS trace_log_caller ON trace_log (caller_id, open_ns)",
+  "CREATE INDEX IF NOT EXISTS trace_log_path ON trace_log (path_id, open_ns)",
+  "CREATE INDEX IF NOT EXISTS op_stats_time ON op_stats (time_ns)",
+  NULL
+};
+
+static int
+db_prepare(const char *sql, sqlite3_stmt **stmt)
+{
+  if (sqlite3_prepare_v2(log, sql, -1, stmt, NULL) != SQLITE_OK)
+    return MONFS_ERR_DB_EXEC;
+
+  return MONFS_OK;
+}
+
+/*
+ * Read the schema version of the open database: 0 if it is empty, 1 for
+ * the unversioned layout.  Returns SQLITE_OK, SQLITE_NOTADB for a file
+ * that is no database, or whatever else kept it from being read.
+ */
+static int
+db_version(int *version)
+{
+  sqlite3_stmt *stmt;
+  int res, tables, meta;
+
+  /* reads the schema, so this is where a file that is no database fails */
+  res = sqlite3_prepare_v2(log, "SELECT count(*), total(name = 'meta') "
+			   "FROM sqlite_master", -1, &stmt, NULL);
+  if (res != SQLITE_OK)
+    return res;
+  res = sqlite3_step(stmt);
+  tables = sqlite3_column_int(stmt, 0);
+  meta = sqlite3_column_int(stmt, 1);
+  sqlite3_finalize(stmt);
+  if (res != SQLITE_ROW)
+    return res;
+
+  if (tables == 0 || meta == 0) {
+    *version = (tables == 0 ? 0 : 1);
+    return SQLITE_OK;
+  }
+
+  res = sqlite3_prepare_v2(log, "SELECT value FROM meta "
+			   "WHERE key = 'schema_version'", -1, &stmt, NULL);
+  if (res != SQLITE_OK)
+    return res;
+  res = sqlite3_step(stmt);
+  if (res == SQLITE_ROW)
+    *version = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  if (res == SQLITE_DONE)
+    return SQLITE_CORRUPT; /* meta without a version */
+  return (res == SQLITE_ROW ? SQLITE_OK : res);
+}
+
+/*
+ * Create whatever is missing.  Every statement is idempotent, so two
+ * mounts logging to the same database may both run it.
+ */
+static int
+db_create()
+{
+  sqlite3_stmt *stmt;
+  const char **sql;
+  int res;
+
+  if (db_exec_busy("BEGIN IMMEDIATE") != SQLITE_OK)
+    return MONFS_ERR_DB_EXEC;
+
+  for (sql = db_schema; *sql != NULL; sql++) {
+    if (sqlite3_exec(log, *sql, NULL, NULL, NULL) != SQLITE_OK)
+      goto error;
+  }
+
+  if (db_prepare("INSERT OR IGNORE INTO meta VALUES(?, ?)", &stmt) != MONFS_OK)
+    goto error;
+  sqlite3_bind_text(stmt, 1, "schema_version", -1, SQLITE_STATIC);
+  sqlite3_bind_int(stmt, 2, DB_SCHEMA_VERSION);
+  res = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  if (res == SQLITE_DONE) {
+    sqlite3_bind_text(stmt, 1, "created_ns", -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, segment_start);
+    res = sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
+  if (res != SQLITE_DONE)
+    goto error;
+
+  if (db_commit() != MONFS_OK)
+    return MONFS_ERR_DB_EXEC;
+
+  return MONFS_OK;
+
+ error:
+  sqlite3_exec(log, "ROLLBACK", NULL, NULL, NULL);
+  return MONFS_ERR_DB_EXEC;
+}
+
+/* switch the journal mode; 1 if it is in effect */
+static int
+db_journal_mode(const char *mode)
+{
+  sqlite3_stmt *stmt;
+  const char *now;
+  char sql[64];
+  int res = 0;
+
+  snprintf(sql, sizeof(sql), "PRAGMA journal_mode = %s", mode);
+  if (db_prepare(sql, &stmt) != MONFS_OK)
+    return 0;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    now = (const char *) sqlite3_column_text(stmt, 0);
+    res = (now != NULL && strcasecmp(now, mode) == 0);
+  }
+  sqlite3_finalize(stmt);
+
+  return res;
+}
+
+/* the id in disk.strings of the string a staged row refers to by c */
+#define DISK_ID(c)							\
+  "(SELECT d.id FROM main.strings m, disk.strings d "			\
+  "WHERE m.id = " c " AND d.str = m.str)"
+
+/*
+ * Move the staged rows to the attached database on disk, with their
+ * string ids mapped to the ones there, and empty the staging tables.
+ */
+static const char *db_flush_sql[] = {
+  "INSERT OR IGNORE INTO disk.strings (str) SELECT str FROM main.strings",
+  "UPDATE main.trace_log SET caller_id = " DISK_ID("caller_id") ", "
+  "path_id = " DISK_ID("path_id") ", host_id = " DISK_ID("host_id"),
+  "UPDATE main.op_stats SET caller_id = " DISK_ID("caller_id"),
+  "INSERT INTO disk.trace_log SELECT * FROM main.trace_log",
+  "INSERT INTO disk.op_stats SELECT * FROM main.op_stats",
+  "INSERT INTO disk.latency SELECT * FROM main.latency",
+  "DELETE FROM main.trace_log",
+  "DELETE FROM main.op_stats",
+  "DELETE FROM main.latency",
+  "DELETE FROM main.strings",
+  NULL
+};
+
+#undef DISK_ID
+
+/* replace the connection to the database on disk by one to an empty one in memory */
+static int
+db_stage()
+{
+  sqlite3_close(log);
+  if (sqlite3_open(":memory:", &log) != SQLITE_OK)
+    return MONFS_ERR_DB_OPEN;
+
+  return db_create();
+}
+
+/*
+ * Append the rows staged in memory to db_file in one transaction, so
+ * that neither a failed flush nor another mount loses any.
+ */
+static int
+db_flush()
+{
+  const char **sql;
+  char *attach;
+  int res = MONFS_ERR_DB_OPEN;
+
+  backup_next = monfs_clock_realtime_ns() + backup_ns;
+
+  /* reads the schema, so it waits for other mounts as BEGIN does */
+  attach = sqlite3_mprintf("ATTACH DATABASE %Q AS disk", db_file);
+  if (attach == NULL)
+    goto error;
+  if (db_exec_busy(attach) != SQLITE_OK) {
+    sqlite3_free(attach);
+    goto error;
+  }
+  sqlite3_free(attach);
+
+  res = MONFS_ERR_DB_EXEC;
+
+  if (db_exec_busy("BEGIN IMMEDIATE") != SQLITE_OK)
+    goto detach;
+  for (sql = db_flush_sql; *sql != NULL; sql++) {
+    if (sqlite3_exec(log, *sql, NULL, NULL, NULL) != SQLITE_OK)
+      goto rollback;
+  }
+  if (db_exec_busy("COMMIT") != SQLITE_OK)
+    goto rollback;
+
+  res = MONFS_OK;
+  dirty = 0;
+  db_gen++; /* the staged strings are gone */
+  goto detach;
+
+ rollback:
+  sqlite3_exec(log, "ROLLBACK", NULL, NULL, NULL);
+ detach:
+  sqlite3_exec(log, "DETACH DATABASE disk", NULL, NULL, NULL);
+ error:
+  if (res != MONFS_OK)
+    monfs_err_msg(res, db_file);
+
+  return res;
+}
+
+/*
+ * Rename db_path to db_path.<mount time>, or db_path.<mount time>.<n>
+ * if that is taken, e.g. by an earlier move in the same second, and
+ * leave its name in buf.  link() fails rather than replace a file that
+ * exists, which rename() would not; only where there are no hard links
+ * does it fall back to rename().
+ */
+static int
+db_move_aside(const char *db_path, char *buf, size_t size)
+{
+  int i;
+
+  for (i = 0; i < 1000; i++) {
+    if (i == 0)
+      snprintf(buf, size, "%s.%llu", db_path, mount_ns / 1000000000ULL);
+    else
+      snprintf(buf, size, "%s.%llu.%d", db_path,
+	       mount_ns / 1000000000ULL, i);
+
+    if (link(db_path, buf) == 0)
+      return (unlink(db_path) == 0 ? MONFS_OK : MONFS_ERR_DB_OPEN);
+    if (errno == EPERM && access(buf, F_OK) != 0)
+      /* no hard links here; racy, but rename() is all there is */
+      return (rename(db_path, buf) == 0 ? MONFS_OK : MONFS_ERR_DB_OPEN);
+    if (errno != EEXIST && errno != EPERM)
+      return MONFS_ERR_DB_OPEN;
+  }
+
+  return MONFS_ERR_DB_OPEN;
+}
+
+/*
+ * Open db_path and append to it.  A database whose schema version could
+ * be read and differs, or a file that is no database at all, is renamed
+ * to db_path.<time> rather than overwritten; if it cannot be read at
+ * all the mount fails and the file is left alone.
+ */
+static int
+db_open(const char *db_path)
+{
+  char buf[PATH_MAX + 64];
+  int version, res;
+
+  if (sqlite3_open(db_path, &log) != SQLITE_OK)
+    goto error;
+  /* another mount may be creating or writing it */
+  sqlite3_busy_timeout(log, DB_BUSY_TIMEOUT / 1000);
+
+  version = -1;
+  res = db_version(&version);
+  if (res != SQLITE_OK && res != SQLITE_NOTADB) {
+    snprintf(buf, sizeof(buf), "%s : %s", db_path, sqlite3_errstr(res));
+    monfs_err_msg(MONFS_ERR_DB_OPEN, buf);
+    goto error;
+  }
+  if (version == DB_SCHEMA_VERSION || version == 0)
+    goto create;
+
+  sqlite3_close(log);
+  log = NULL;
+
+  if (db_move_aside(db_path, buf, sizeof(buf)) != MONFS_OK) {
+    monfs_err_msg(MONFS_ERR_DB_OPEN, db_path);
+    return MONFS_ERR_DB_OPEN;
+  }
+  if (version < 0)
+    snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
+	     " : no database, moved aside");
+  else
+    snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
+	     " : schema version %d, moved aside", version);
+  monfs_msg(buf);
+
+  if (sqlite3_open(db_path, &log) != SQLITE_OK)
+    goto error;
+  sqlite3_busy_timeout(log, DB_BUSY_TIMEOUT / 1000);
+
+ create:
+  if (staging == DB_STAGING_WAL) {
+    if (!db_journal_mode("wal"))
+      monfs_err_msg(MONFS_ERR_DB_EXEC, "journal_mode = wal");
+    sqlite3_exec(log, "PRAGMA synchronous = NORMAL", NULL, NULL, NULL);
+  }
+
+  res = db_create();
+  if (res == MONFS_OK && staging == DB_STAGING_MEMORY)
+    res = db_stage();
+
+  /* transactions retry with their own backoff, see db_exec_busy() */
+  if (log != NULL)
+    sqlite3_busy_timeout(log, 0);
+
+  return res;
+
+ error:
+  sqlite3_close(log);
+  log = NULL;
+  return MONFS_ERR_DB_OPEN;
+}
+
+static int
+db_prepare_all()
+{
+  int res;
+
+  res = db_prepare("INSERT INTO trace_log VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, "
+		   "?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, "
+		   "?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, "
+		   "?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+		   &insert_stmt);
+  if (res != MONFS_OK)
+    return res;
+
+  res = db_prepare("INSERT OR IGNORE INTO strings (str) VALUES(?)",
+		   &string_insert_stmt);
+  if (res != MONFS_OK)
+    return res;
+
+  res = db_prepare("SELECT id FROM strings WHERE str = ?",
+		   &string_select_stmt);
+  if (res != MONFS_OK)
+    return res;
+
+  return db_prepare("INSERT INTO op_stats VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+		    &ops_stmt);
+}
+
+static void
+db_close()
+{
+  sqlite3_finalize(insert_stmt);
+  sqlite3_finalize(string_insert_stmt);
+  sqlite3_finalize(string_select_stmt);
+  sqlite3_finalize(ops_stmt);
+  insert_stmt = string_insert_stmt = string_select_stmt = ops_stmt = NULL;
+  sqlite3_close(log);
+  log = NULL;
+}
+
+/*
+ * Sealed segments are named <db_path>.<start>-<end>, both in seconds
+ * since the epoch.  Returns the end, or 0 if name is no segment of
+ * db_path.
+ */
+static unsigned long long
+segment_end_time(const char *name, const char *base)
+{
+  unsigned long long start, end;
+  size_t len = strlen(base);
+  int n = 0;
+
+  if (strncmp(name, base, len) != 0 || name[len] != '.')
+    return 0;
+  if (sscanf(name + len + 1, "%llu-%llu%n", &start, &end, &n) != 2 ||
+      name[len + 1 + n] != '\0')
+    return 0;
+
+  return end;
+}
+
+/*
+ * The compactor thread builds the indexes of the live database and of
+ * each sealed segment, VACUUMs the sealed ones, then deletes the
+ * segments older than db_retention.  It has its own connection, so the
+ * logger thread never does either.
+ */
+struct segment {
+  char *path;
+  int live; /* only build the indexes */
+  struct segment *next;
+};
+
+static pthread_t compactor;
+static int compactor_running = 0;
+static pthread_mutex_t compact_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compact_cond = PTHREAD_COND_INITIALIZER;
+static struct segment *compact_head = NULL, **compact_tail = &compact_head;
+static int compact_stop = 0;
+
+static void
+compact_enqueue(const char *path, int live)
+{
+  struct segment *seg;
+
+  seg = malloc(sizeof(struct segment));
+  if (seg == NULL)
+    return;
+  seg->path = strdup(path);
+  if (seg->path == NULL) {
+    free(seg);
+    return;
+  }
+  seg->live = live;
+  seg->next = NULL;
+
+  pthread_mutex_lock(&compact_mutex);
+  *compact_tail = seg;
+  compact_tail = &(seg->next);
+  pthread_cond_signal(&compact_cond);
+  pthread_mutex_unlock(&compact_mutex);
+}
+
+static int
+build_indexes(sqlite3 *db)
+{
+  const char **sql;
+
+  for (sql = db_indexes; *sql != NULL; sql++) {
+    if (sqlite3_exec(db, *sql, NULL, NULL, NULL) != SQLITE_OK)
+      return MONFS_ERR_DB_EXEC;
+  }
+
+  return MONFS_OK;
+}
+
+/*
+ * Compacted once; a segment compacted by an earlier mount is skipped.
+ * The live database only gets its indexes.
+ */
+static void
+compact_segment(const char *path, int live)
+{
+  sqlite3 *db;
+  sqlite3_stmt *stmt;
+  int done = 0;
+
+  if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
+    goto error;
+  sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT / 1000);
+
+  if (live) {
+    if (build_indexes(db) != MONFS_OK)
+      goto error;
+    goto out;
+  }
+
+  if (sqlite3_prepare_v2(db, "SELECT 1 FROM meta WHERE key = 'compacted_ns'",
+			 -1, &stmt, NULL) != SQLITE_OK)
+    goto error;
+  done = (sqlite3_step(stmt) == SQLITE_ROW);
+  sqlite3_finalize(stmt);
+  if (done)
+    goto out;
+
+  if (build_indexes(db) != MONFS_OK)
+    goto error;
+
+  if (sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO meta VALUES('compacted_ns', ?)",
+			 -1, &stmt, NULL) != SQLITE_OK)
+    goto error;
+  sqlite3_bind_int64(stmt, 1, monfs_clock_realtime_ns());
+  done = (sqlite3_step(stmt) == SQLITE_DONE);
+  sqlite3_finalize(stmt);
+  if (!done || sqlite3_exec(db, "VACUUM", NULL, NULL, NULL) != SQLITE_OK)
+    goto error;
+
+ out:
+  sqlite3_close(db);
+  return;
+
+ error:
+  monfs_err_msg(MONFS_ERR_DB_EXEC, path);
+  sqlite3_close(db);
+}
+
+/*
+ * Delete the segments of db_file that ended more than db_retention ago;
+ * with queue set, hand the others to the compactor instead.
+ */
+static void
+scan_segments(int queue)
+{
+  char *dir_copy, *base_copy, *dir, *base, path[PATH_MAX];
+  unsigned long long end, now;
+  struct dirent *d;
+  DIR *dp;
+
+  dir_copy = strdup(db_file);
+  base_copy = strdup(db_file);
+  if (dir_copy == NULL || base_copy == NULL)
+    goto out;
+  dir = dirname(dir_copy);
+  base = basename(base_copy);
+
+  dp = opendir(dir);
+  if (dp == NULL)
+    goto out;
+
+  now = monfs_clock_realtime_ns();
+  while ((d = readdir(dp)) != NULL) {
+    end = segment_end_time(d->d_name, base);
+    if (end == 0)
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+
+    if (retention_ns > 0 && end * 1000000000ULL + retention_ns < now) {
+      if (unlink(path) != 0)
+	monfs_err_msg(MONFS_ERR_DB_OPEN, path);
+    } else if (queue) {
+      compact_enqueue(path, 0);
+    }
+  }
+  closedir(dp);
+
+ out:
+  free(dir_copy);
+  free(base_copy);
+}
+
+static void *
+do_compaction(void *args)
+{
+  struct segment *seg;
+  int last;
+
+  /* left over from earlier mounts */
+  scan_segments(1);
+
+  pthread_mutex_lock(&compact_mutex);
+  while (!compact_stop) {
+    seg = compact_head;
+    if (seg == NULL) {
+      pthread_cond_wait(&compact_cond, &compact_mutex);
+      continue;
+    }
+    compact_head = seg->next;
+    last = (compact_head == NULL);
+    if (last)
+      compact_tail = &compact_head;
+    pthread_mutex_unlock(&compact_mutex);
+
+    compact_segment(seg->path, seg->live);
+    free(seg->path);
+    free(seg);
+    if (last)
+      scan_segments(0);
+
+    pthread_mutex_lock(&compact_mutex);
+  }
+  pthread_mutex_unlock(&compact_mutex);
+
+  return NULL;
+}
+
+/* of the live database on disk */
+static unsigned long long
+db_size()
+{
+  sqlite3_stmt *stmt;
+  struct stat st;
+  unsigned long long size = 0;
+
+  if (staging == DB_STAGING_MEMORY)
+    return (stat(db_file, &st) == 0 ? st.st_size : 0);
+
+  if (db_prepare("SELECT page_count * page_size FROM pragma_page_count(), "
+		 "pragma_page_size()", &stmt) != MONFS_OK)
+    return 0;
+  if (sqlite3_step(stmt) == SQLITE_ROW)
+    size = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  return size;
+}
+
+/* of mount_lock, with F_RDLCK, F_WRLCK or F_UNLCK; -1 if it is taken */
+static int
+mount_lock_set(int type, int cmd)
+{
+  struct flock fl;
+
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+
+  return fcntl(mount_lock, cmd, &fl);
+}
+
+/*
+ * Seal the live database once its db_rotate window has passed or it has
+ * grown past db_rotate_size, and go on in a new one, so that the B-trees the
+ * logger inserts into stay small however long the mount lives.  Called
+ * between transactions; strings are interned again per segment, so that
+ * each one can be read on its own.
+ */
+static int
+db_rotate()
+{
+  char seg[PATH_MAX + 64];
+  unsigned long long now;
+  int res;
+
+  if (log != NULL) {
+    if (rotate_ns == 0 && rotate_bytes == 0)
+      return MONFS_OK;
+
+    now = monfs_clock_realtime_ns();
+    if (now / 1000000000ULL == segment_start / 1000000000ULL)
+      return MONFS_OK; /* segment names have a resolution of a second */
+    if (!(rotate_ns > 0 && now >= segment_end) &&
+	!(rotate_bytes > 0 && db_size() >= rotate_bytes))
+      return MONFS_OK;
+
+    /* converts the read lock atomically, so no mount can join meanwhile */
+    if (mount_lock < 0 || mount_lock_set(F_WRLCK, F_SETLK) != 0) {
+      if (!mount_shared) {
+	snprintf(seg, sizeof(seg), "%s : shared with another mount, "
+		 "not rotated", db_file);
+	monfs_msg(seg);
+	mount_shared = 1;
+      }
+      return MONFS_OK;
+    }
+
+    /*
+     * Seal the segment without a -wal file beside it, which the next
+     * segment would pick up; with a reader still attached, try again
+     * next transaction.
+     */
+    if ((staging != DB_STAGING_MEMORY && !db_journal_mode("delete")) ||
+	(staging == DB_STAGING_MEMORY && db_flush() != MONFS_OK)) {
+      mount_lock_set(F_RDLCK, F_SETLK);
+      return MONFS_OK;
+    }
+
+    db_close();
+
+    snprintf(seg, sizeof(seg), "%s.%llu-%llu", db_file,
+	     segment_start / 1000000000ULL, now / 1000000000ULL);
+    if (rename(db_file, seg) != 0)
+      monfs_err_msg(MONFS_ERR_DB_OPEN, seg);
+    else if (compactor_running)
+      compact_enqueue(seg, 0);
+    mount_lock_set(F_RDLCK, F_SETLK);
+
+    db_gen++;
+    segment_start = now;
+    if (rotate_ns > 0)
+      segment_end = (now / rotate_ns + 1) * rotate_ns;
+  }
+
+  /* also retries a segment that could not be opened */
+  res = db_open(db_file);
+  if (res == MONFS_OK)
+    res = db_prepare_all();
+  if (res != MONFS_OK) {
+    monfs_err_msg(res, db_file);
+    db_close();
+  } else if (compactor_running) {
+    compact_enqueue(db_file, 1);
+  }
+
+  return res;
+}
+
+static int
+parse_staging(const char *what)
+{
+  if (strcmp(what, "off") == 0)
+    return DB_STAGING_OFF;
+  if (strcmp(what, "wal") == 0)
+    return DB_STAGING_WAL;
+  if (strcmp(what, "memory") == 0)
+    return DB_STAGING_MEMORY;
+
+  return -1;
+}
+
+static int
+db_init(const char *db_path) {
+  char lock[PATH_MAX + 8];
+  int res;
+
+  if (log != NULL)
+    return MONFS_ERR_DB_INIT;
+
+  db_file = strdup(db_path);
+  if (db_file == NULL)
+    return MONFS_ERR_NO_MEMORY;
+
+  mount_ns = monfs_clock_realtime_ns();
+  segment_start = mount_ns;
+  rotate_ns = monfs_config_get_db_rotate() * 1000000000ULL;
+  rotate_bytes = monfs_config_get_db_rotate_size() * 1048576ULL;
+  retention_ns = monfs_config_get_db_retention() * 3600000000000ULL;
+  if (rotate_ns > 0)
+    segment_end = (mount_ns / rotate_ns + 1) * rotate_ns;
+
+  staging = parse_staging(monfs_config_get_db_staging());
+  if (staging < 0) {
+    monfs_err_msg(MONFS_ERR_CONF_PARSE, monfs_config_get_db_staging());
+    res = MONFS_ERR_DB_INIT;
+    goto error;
+  }
+  backup_ns = monfs_config_get_db_backup_interval() * 1000000000ULL;
+  backup_next = mount_ns + backup_ns;
+  dirty = 0;
+
+  /* waits for a mount sealing db_path to be done */
+  snprintf(lock, sizeof(lock), "%s.lock", db_path);
+  mount_lock = open(lock, O_RDWR | O_CREAT, 0644);
+  if (mount_lock >= 0 && mount_lock_set(F_RDLCK, F_SETLKW) != 0) {
+    close(mount_lock);
+    mount_lock = -1;
+  }
+  if (mount_lock < 0)
+    monfs_err_msg(MONFS_ERR_DB_OPEN, lock);
+  mount_shared = 0;
+
+  res = db_open(db_path);
+  if (res == MONFS_OK)
+    res = db_prepare_all();
+  if (res != MONFS_OK)
+    goto error;
+
+  compact_stop = 0;
+  compact_enqueue(db_file, 1);
+  if (pthread_create(&compactor, NULL, do_compaction, NULL) == 0)
+    compactor_running = 1;
+  else
+    monfs_err_msg(MONFS_ERR_DB_INIT, "compactor");
+
+  return MONFS_OK;
+
+ error:
+  db_close();
+  if (mount_lock >= 0)
+    close(mount_lock);
+  mount_lock = -1;
+  free(db_file);
+  db_file = NULL;
+  return res;
+}
+
+/*
+ * Segments still waiting for the compactor are compacted next mount.
+ * Called after the last commit, so a memory staged db is complete here.
+ */
+static void
+db_destroy() {
+  struct segment *seg;
+
+  if (compactor_running) {
+    pthread_mutex_lock(&compact_mutex);
+    compact_stop = 1;
+    pthread_cond_signal(&compact_cond);
+    pthread_mutex_unlock(&compact_mutex);
+    pthread_join(compactor, NULL);
+    compactor_running = 0;
+
+    while ((seg = compact_head) != NULL) {
+      compact_head = seg->next;
+      free(seg->path);
+      free(seg);
+    }
+    compact_tail = &compact_head;
+  }
+
+  if (staging == DB_STAGING_MEMORY && log != NULL)
+    db_flush();
+  db_close();
+  if (mount_lock >= 0)
+    close(mount_lock);
+  mount_lock = -1;
+  free(db_file);
+  db_file = NULL;
+}
+
+static int
+db_save_latency(const char *op, const struct hist_sum *sum)
+{
+  sqlite3_stmt *stmt;
+  int i, res = MONFS_OK;
+
+  if (db_prepare("INSERT INTO latency VALUES(?, ?, ?, ?, ?)", &stmt) != MONFS_OK)
+    return MONFS_ERR_DB_EXEC;
+
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    if (sum->counts[i] == 0)
+      continue;
+    sqlite3_bind_int64(stmt, 1, mount_ns);
+    sqlite3_bind_text(stmt, 2, op, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, hist_bucket_low(i));
+    sqlite3_bind_int64(stmt, 4, hist_bucket_high(i));
+    sqlite3_bind_int64(stmt, 5, sum->counts[i]);
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+      res = MONFS_ERR_DB_EXEC;
+    sqlite3_reset(stmt);
+  }
+
+  sqlite3_finalize(stmt);
+  return res;
+}
+
+static int
+db_insert_op(const struct opstat_snapshot *s, int op, const struct op_count *c,
+	     const struct opstat_caller *caller)
+{
+  unsigned long long v[LOGGER_PERCENTILES];
+  int k, res;
+
+  sqlite3_bind_int64(ops_stmt, 1, s->time);
+  sqlite3_bind_int64(ops_stmt, 2, s->interval);
+  sqlite3_bind_text(ops_stmt, 3, opstat_name(op), -1, SQLITE_STATIC);
+  if (caller != NULL) {
+    sqlite3_bind_int64(ops_stmt, 4, caller->pid);
+    bind_id(ops_stmt, 5, db_string_id(caller->caller_path));
+  } else {
+    sqlite3_bind_null(ops_stmt, 4);
+    sqlite3_bind_null(ops_stmt, 5);
+  }
+  sqlite3_bind_int64(ops_stmt, 6, c->count);
+  sqlite3_bind_int64(ops_stmt, 7, c->errors);
+  sqlite3_bind_int64(ops_stmt, 8, c->nsec);
+
+  /* latency percentiles for the totals only */
+  if (caller == NULL) {
+    hist_sum_percentiles(&(s->hist[op]), logger_percentiles, v,
+			 LOGGER_PERCENTILES);
+    for (k = 0; k < LOGGER_PERCENTILES; k++)
+      sqlite3_bind_int64(ops_stmt, 9 + k, v[k]);
+    sqlite3_bind_int64(ops_stmt, 9 + k, s->hist[op].max);
+  } else {
+    for (k = 0; k <= LOGGER_PERCENTILES; k++)
+      sqlite3_bind_null(ops_stmt, 9 + k);
+  }
+
+  res = sqlite3_step(ops_stmt);
+  sqlite3_reset(ops_stmt);
+
+  return (res == SQLITE_DONE ? MONFS_OK : MONFS_ERR_DB_EXEC);
+}
+
+static int
+db_log_ops(const struct opstat_snapshot *s)
+{
+  unsigned long i;
+  int op, res = MONFS_OK;
+
+  for (op = 0; op < MONFS_OPS; op++) {
+    if (s->ops[op].count > 0 &&
+	db_insert_op(s, op, &(s->ops[op]), NULL) != MONFS_OK)
+      res = MONFS_ERR_DB_EXEC;
+  }
+
+  for (i = 0; i < s->ncallers; i++) {
+    for (op = 0; op < MONFS_OPS; op++) {
+      if (s->callers[i].ops[op].count > 0 &&
+	  db_insert_op(s, op, &(s->callers[i].ops[op]),
+		       &(s->callers[i])) != MONFS_OK)
+	res = MONFS_ERR_DB_EXEC;
+    }
+  }
+
+  return res;
+}
+
+/* the commit of a batch, after which a memory staged db may be due for a flush */
+static int
+db_log_commit()
+{
+  int res;
+
+  res = db_commit();
+  if (res == MONFS_OK && staging == DB_STAGING_MEMORY) {
+    dirty = 1;
+    if (monfs_clock_realtime_ns() >= backup_next)
+      db_flush();
+  }
+
+  return res;
+}
+
+/* flush a memory staged db that has waited db_backup_interval */
+static int
+db_idle()
+{
+  if (log == NULL || !dirty || monfs_clock_realtime_ns() < backup_next)
+    return 0;
+
+  db_flush();
+  return 1;
+}
+
+const struct logger_backend sqlite_logger = {
+  "sqlite",
+  db_init,
+  db_destroy,
+  db_begin,
+  db_insert,
+  db_log_commit,
+  db_save_latency,
+  db_log_ops,
+  db_idle
+};
@@ -21,60 +21,64 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <sys/stat.h>
 #include <monfs.h>
+#include <monfs_trace.h>
 #include "config.h"
 #include "error.h"
 #include "access_profile.h"
 #include "access_profile_queue.h"
 #include "logger.h"
-#include "hash.h"
-
-static struct hash_table *apt = NULL;
-#define APT_SIZE 1024
+#include "pool.h"
+#include "strtab.h"
+#include "caller.h"
+#include "clock.h"
+#include "trace.h"
+#include "filter.h"
+#include "counter.h"
+#include "opstat.h"
 
 static int monitored = 0;
+static struct pool *file_pool = NULL; /* struct monfs_file, see below */
+static const char *local_hostname = NULL; /* interned */
 
-static int
-enter_into_table(uint64_t fh, struct access_profile *ap)
+int
+monfs_monitor_set_config(const char *name, const char *value)
 {
-  struct hash_entry *entry;
-  int created;
-  struct access_profile **app;
-
-  entry = hash_enter(apt, &fh, sizeof(uint64_t), sizeof(struct access_profile **), &created);
-  if (entry == NULL || !created)
-    return MONFS_ERR_NO_ENTRY_SPACE;
-	
-  app = (struct access_profile **)hash_entry_data(entry);
-  *app = ap;
-	
-  return MONFS_OK;
+  int res;
+
+  res = monfs_config_set(name, value);
+  if (res != MONFS_OK)
+    monfs_err_msg(res, name);
+
+  return res;
 }
 
-static int
-refer_to_table(uint64_t fh, struct access_profile **app)
+/*
+ * Read settings and filter rules from filename, or from MONFS_CONFIG if
+ * NULL, which need not exist.  Like monfs_monitor_set_config(), this is
+ * for before monfs_monitor_init().
+ */
+int
+monfs_monitor_read_config(const char *filename)
 {
-  struct hash_entry *entry;
+  int res;
 
-  entry = hash_lookup(apt, &fh, sizeof(uint64_t));
-  if (entry == NULL)
-    return MONFS_ERR_NO_ENTRY;
-  
-  *app = *((struct access_profile **)hash_entry_data(entry));
+  if (filename != NULL)
+    monfs_config_set_filename(filename);
 
-  return MONFS_OK;
-}
+  res = monfs_config_read();
+  if (res == MONFS_ERR_CONF_OPEN) {
+    if (filename == NULL)
+      return MONFS_OK;
+    monfs_err_msg(res, filename);
+  }
 
-static int
-purge_from_table(uint64_t fh)
-{
-  if (hash_purge(apt, &fh, sizeof(uint64_t)))
-    return MONFS_OK;
-  else
-    return MONFS_ERR_ENTRY_NOT_PURGED;
+  return res;
 }
 
 int
@@ -87,29 +91,48 @@ monfs_monitor_init(const char *filename)
       monfs_config_set_db_path(filename);
   }
 
-#if 0
-  if (filename != NULL) {
-    monfs_config_set_filename(filename);
-  }
-
+  /* handles are needed even if monitoring fails to start */
+  file_pool = pool_create(sizeof(struct monfs_file));
 
-  res = monfs_config_read();
+  res = strtab_init();
   if (res != MONFS_OK) {
     monfs_err_msg(res, NULL);
     return res;
   }
-#endif  
 
-  apt = hash_table_alloc(APT_SIZE, hash_default, hash_key_equal_default);
-  if (apt == NULL) {
-    res = MONFS_ERR_NO_MEMORY;
+  caller_cache_init();
+  monfs_clock_init();
+
+  res = ap_pool_init();
+  if (res != MONFS_OK) {
+    caller_cache_destroy();
+    strtab_destroy();
     monfs_err_msg(res, NULL);
     return res;
   }
 
+  if (monfs_config_get_trace_path() != NULL) {
+    res = trace_init(monfs_config_get_trace_path(),
+		     monfs_config_get_trace_size());
+    if (res != MONFS_OK) {
+      ap_pool_destroy();
+      caller_cache_destroy();
+      strtab_destroy();
+      monfs_err_msg(res, NULL);
+      return res;
+    }
+  }
+
+  opstat_init();
+
   db_path = monfs_config_get_db_path();
   res = start_logger(db_path);
   if (res != MONFS_OK) {
+    opstat_destroy();
+    trace_destroy();
+    ap_pool_destroy();
+    caller_cache_destroy();
+    strtab_destroy();
     monfs_err_msg(res, NULL);
     return res;
   }
@@ -119,139 +142,370 @@ monfs_monitor_init(const char *filename)
   return MONFS_OK;
 }
 
+static void
+report_pool_stats(const char *name, struct pool_stats *s)
+{
+  char buf[256];
+
+  if (s->hits == 0 && s->misses == 0)
+    return; /* never used, e.g. no file was opened */
+
+  snprintf(buf, sizeof(buf),
+	   "%s pool : %llu hits, %llu misses on %lu threads",
+	   name, s->hits, s->misses, s->threads);
+  monfs_msg(buf);
+}
+
+static void
+report_caller_stats()
+{
+  char buf[256];
+  struct caller_cache_stats s;
+
+  caller_cache_get_stats(&s);
+  snprintf(buf, sizeof(buf),
+	   "caller cache : %llu hits, %llu misses, %llu reused pids",
+	   s.hits, s.misses, s.reused);
+  monfs_msg(buf);
+}
+
+static void
+report_queue_stats()
+{
+  char buf[256];
+  uint64_t c[COUNTERS];
+
+  counter_sum(c);
+  if (c[COUNTER_DROPPED] + c[COUNTER_FOLDED] + c[COUNTER_BLOCKED] +
+      c[COUNTER_SAMPLED_OUT] == 0)
+    return;
+
+  snprintf(buf, sizeof(buf),
+	   "queue : %llu dropped, %llu folded, %llu blocked closes, "
+	   "%llu sampled out",
+	   (unsigned long long)c[COUNTER_DROPPED],
+	   (unsigned long long)c[COUNTER_FOLDED],
+	   (unsigned long long)c[COUNTER_BLOCKED],
+	   (unsigned long long)c[COUNTER_SAMPLED_OUT]);
+  monfs_msg(buf);
+}
+
 void
 monfs_monitor_destroy()
 {
+  struct pool_stats s;
+
   if (monitored) {
+    monitored = 0;
     stop_logger();
-  // TODO table free
-    monfs_config_free_db_path();
+    report_queue_stats();
+    opstat_destroy();
+    trace_destroy();
+    ap_pool_get_stats(&s);
+    report_pool_stats("profile", &s);
+    ap_pool_destroy();
+    report_caller_stats();
+    caller_cache_destroy();
+    str_release(local_hostname);
+    local_hostname = NULL;
+    strtab_destroy();
+    monfs_config_free();
   }
 
+  if (file_pool != NULL) {
+    pool_get_stats(file_pool, &s);
+    report_pool_stats("file", &s);
+    pool_destroy(file_pool);
+    file_pool = NULL;
+  }
 }
 
-static char *
-get_caller_path(pid_t pid)
+/*
+ * The handle behind fi->fh, allocated on the FUSE thread that opens a
+ * file and freed on the one that releases it, so from a per-thread pool
+ * as profiles are; plain malloc if the pool could not be created.
+ */
+struct monfs_file *
+monfs_monitor_file_alloc()
 {
-  int res;
-  char exe[PATH_MAX + 1], caller[PATH_MAX + 1];
+  if (file_pool == NULL)
+    return malloc(sizeof(struct monfs_file));
 
-  memset(exe, 0, PATH_MAX+1);
-  memset(caller, 0, PATH_MAX+1);
+  return pool_get(file_pool);
+}
 
-  sprintf(exe, "/proc/%d/exe", pid);
+void
+monfs_monitor_file_free(struct monfs_file *file)
+{
+  if (file_pool == NULL)
+    free(file);
+  else
+    pool_put(file);
+}
 
-  res = readlink(exe, caller, strlen(exe)+1);
-  if (res == -1)
-    return NULL;
+/*
+ * In deferred mode the caller is only taken from the cache here; on a
+ * miss the logger thread resolves it, see log_batch().
+ */
+static const char *
+get_caller_path(pid_t pid)
+{
+  if (monfs_config_get_caller_defer())
+    return caller_lookup_cached(pid);
 
-  return strdup(caller);
+  return caller_lookup(pid);
 }
 
 int
-monfs_monitor_open(pid_t pid, uint64_t fh, const char *path)
+monfs_monitor_open(pid_t pid, struct monfs_file *file, const char *path)
 {
   int res;
   struct access_profile *ap;
-  char *caller_path;
+  struct stat st;
+
+  file->ap = NULL;
 
   if (!monitored)
     return MONFS_OK_NOT_MONITORED;
 
+  /* filtered out: no profile, nothing logged */
+  if (path != NULL && !filter_match(path)) {
+    counter_add(COUNTER_FILTERED, 1);
+    return MONFS_OK_NOT_MONITORED;
+  }
+
   res = ap_alloc(&ap);
   if (res != MONFS_OK) {
     monfs_err_msg(res, NULL);
     return res;
   }
   
-  ap_set_path(ap, path);
+  ap_set_path(ap, str_intern(path != NULL ? path : ""));
   ap_set_open(ap);
-  caller_path = get_caller_path(pid);
-  ap_set_caller(ap, pid, caller_path);
-  free(caller_path);
+  ap_set_caller(ap, pid, get_caller_path(pid));
+  if (fstat(file->fd, &st) == 0)
+    ap_set_blksize(ap, st.st_blksize);
 
-  res = enter_into_table(fh, ap);
-  if (res != MONFS_OK) {
-    ap_free(ap);
-    monfs_err_msg(res, NULL);
-    return res;
-  }
+  file->ap = ap;
+
+  counter_add(COUNTER_OPENS, 1);
+  if (tracing)
+    trace_event(MONFS_TRACE_OPEN, (uintptr_t)file, 0, 0, 0, pid);
 
   return MONFS_OK;
 }
 
+/*
+ * size is the size requested, bytes the number transferred.  Threads
+ * sharing a file may call these concurrently; ap_update_read/
+ * ap_update_write are safe for that.
+ */
 int
-monfs_monitor_read(uint64_t fh, ssize_t size, struct timeval *time)
+monfs_monitor_read(struct monfs_file *file, size_t size, ssize_t bytes,
+		   off_t offset, unsigned long long nsec)
 {
-  struct access_profile *ap;
-  int res;
-
-  if (!monitored)
+  if (file->ap == NULL)
     return MONFS_OK_NOT_MONITORED;
 
-  res = refer_to_table(fh, &ap);
-  if (res != MONFS_OK) {
-    monfs_err_msg(res, NULL);
-    return res;
-  }
+  ap_update_read(file->ap, size, bytes, offset, nsec);
+  counter_add(COUNTER_READS, 1);
+  counter_add(COUNTER_READ_BYTES, bytes);
+  if (tracing)
+    trace_event(MONFS_TRACE_READ, (uintptr_t)file, offset, bytes, nsec, 0);
+  return MONFS_OK;
+}
+
+int
+monfs_monitor_write(struct monfs_file *file, size_t size, ssize_t bytes,
+		    off_t offset, unsigned long long nsec)
+{
+  if (file->ap == NULL)
+    return MONFS_OK_NOT_MONITORED;
 
-  ap_update_read(ap, size, time);
+  ap_update_write(file->ap, size, bytes, offset, nsec);
+  counter_add(COUNTER_WRITES, 1);
+  counter_add(COUNTER_WRITE_BYTES, bytes);
+  if (tracing)
+    trace_event(MONFS_TRACE_WRITE, (uintptr_t)file, offset, bytes, nsec, 0);
   return MONFS_OK;
 }
 
+static const int sync_trace_ops[] = {
+  [MONFS_SYNC_FSYNC] = MONFS_TRACE_FSYNC,
+  [MONFS_SYNC_FDATASYNC] = MONFS_TRACE_FDATASYNC,
+  [MONFS_SYNC_FLUSH] = MONFS_TRACE_FLUSH,
+  [MONFS_SYNC_FTRUNCATE] = MONFS_TRACE_FTRUNCATE,
+};
+
+/* a successful fsync, fdatasync, flush or ftruncate (MONFS_SYNC_*) */
 int
-monfs_monitor_write(uint64_t fh, ssize_t size, struct timeval *time )
+monfs_monitor_sync(struct monfs_file *file, int kind, unsigned long long nsec)
 {
-  struct access_profile *ap;
-  int res;
+  unsigned long long bytes;
 
-  if (!monitored)
+  if (file->ap == NULL)
     return MONFS_OK_NOT_MONITORED;
 
-  res = refer_to_table(fh, &ap);
-  if (res != MONFS_OK) {
-    monfs_err_msg(res, NULL);
-    return res;
+  bytes = ap_update_sync(file->ap, kind, nsec);
+  if (tracing)
+    trace_event(sync_trace_ops[kind], (uintptr_t)file, 0,
+		bytes < UINT32_MAX ? bytes : UINT32_MAX, nsec, 0);
+  return MONFS_OK;
+}
+
+/* a finished file system operation, res < 0 if it failed */
+void
+monfs_monitor_op(int op, pid_t pid, unsigned long long nsec, int res)
+{
+  if (opstat_enabled)
+    opstat_record(op, pid, nsec, res);
+}
+
+unsigned long long
+monfs_monitor_clock()
+{
+  return monfs_clock_ns();
+}
+
+int
+monfs_monitor_read_copy()
+{
+  return monfs_config_get_read_copy();
+}
+
+/* every close passes the same hostname, so keep it at hand */
+static const char *
+intern_hostname(const char *hostname)
+{
+  const char *h, *expected = NULL;
+
+  h = __atomic_load_n(&local_hostname, __ATOMIC_ACQUIRE);
+  if (h == NULL) {
+    h = str_intern(hostname);
+    if (h == NULL)
+      return NULL;
+    if (!__atomic_compare_exchange_n(&local_hostname, &expected, h, 0,
+				     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      str_release(h);
+      h = expected;
+    }
   }
 
-  ap_update_write(ap, size, time);
-  return MONFS_OK;
+  if (strcmp(h, hostname) == 0)
+    return str_ref(h);
+
+  return str_intern(hostname);
 }
 
 int
-monfs_monitor_close(uint64_t fh, const char *hostname)
+monfs_monitor_close(struct monfs_file *file, const char *hostname)
 {
-  struct access_profile *ap;
-  int res, res_save;
+  struct access_profile *ap = file->ap;
+  int res;
 
-  if (!monitored)
+  if (ap == NULL)
     return MONFS_OK_NOT_MONITORED;
 
-  res = refer_to_table(fh, &ap);
-  if (res != MONFS_OK) {
-    monfs_err_msg(res, NULL);
-    res_save = res;
-    goto finish; // do not log
-  }
+  file->ap = NULL;
+  counter_add(COUNTER_CLOSES, 1);
 
   if (hostname == NULL) {
-    res = MONFS_OK;
-    goto finish; // do not log
+    ap_free(ap);
+    return MONFS_OK; // do not log
   }
 
   ap_set_close(ap);
-  ap_set_hostname(ap, hostname);
+  if (tracing)
+    trace_event(MONFS_TRACE_CLOSE, (uintptr_t)file, 0, 0,
+		ap_get_duration(ap), 0);
+  ap_set_hostname(ap, intern_hostname(hostname));
 
+  /* queued, folded or dropped as queue_overflow says */
   res = apq_enqueue(ap);
-  if (res != MONFS_OK) {
-    ap_free(ap);
-    monfs_err_msg(res, NULL);
-  }
-
- finish:
-  res = purge_from_table(fh);
   if (res != MONFS_OK)
     monfs_err_msg(res, NULL);
 
-  return (res_save != 0 ? res_save : res);
+  return res;
+}
+
+/*
+ * Render the live statistics as "name value" lines into buf.
+ * Returns the length the whole text needs, like snprintf().
+ */
+int
+monfs_monitor_stats(char *buf, size_t size)
+{
+  uint64_t c[COUNTERS];
+  struct logger_stats ls;
+  struct apq_stats qs;
+  unsigned long strings = 0;
+  double load_factor = 0;
+
+  counter_sum(c);
+  logger_get_stats(&ls);
+  memset(&qs, 0, sizeof(qs));
+  qs.sample_rate = 1;
+  if (monitored) {
+    apq_get_stats(&qs);
+    strings = strtab_count();
+    load_factor = strtab_load_factor();
+  }
+
+  return snprintf(buf, size,
+		  "opens %llu\n"
+		  "filtered_opens %llu\n"
+		  "closes %llu\n"
+		  "open_handles %llu\n"
+		  "reads %llu\n"
+		  "writes %llu\n"
+		  "read_bytes %llu\n"
+		  "write_bytes %llu\n"
+		  "queue_depth %lu\n"
+		  "queue_capacity %lu\n"
+		  "queue_bytes %llu\n"
+		  "dropped %llu\n"
+		  "folded %llu\n"
+		  "folded_paths %lu\n"
+		  "blocked_closes %llu\n"
+		  "sampled_out %llu\n"
+		  "sample_rate %lu\n"
+		  "logged %llu\n"
+		  "logger_lag %llu\n"
+		  "batches %llu\n"
+		  "commit_last_usec %llu\n"
+		  "commit_avg_usec %llu\n"
+		  "commit_max_usec %llu\n"
+		  "strings %lu\n"
+		  "string_load_factor %.2f\n",
+		  (unsigned long long)c[COUNTER_OPENS],
+		  (unsigned long long)c[COUNTER_FILTERED],
+		  (unsigned long long)c[COUNTER_CLOSES],
+		  (unsigned long long)(c[COUNTER_OPENS] > c[COUNTER_CLOSES] ?
+				       c[COUNTER_OPENS] - c[COUNTER_CLOSES] : 0),
+		  (unsigned long long)c[COUNTER_READS],
+		  (unsigned long long)c[COUNTER_WRITES],
+		  (unsigned long long)c[COUNTER_READ_BYTES],
+		  (unsigned long long)c[COUNTER_WRITE_BYTES],
+		  qs.length,
+		  qs.capacity,
+		  qs.bytes,
+		  (unsigned long long)c[COUNTER_DROPPED],
+		  (unsigned long long)c[COUNTER_FOLDED],
+		  qs.summaries,
+		  (unsigned long long)c[COUNTER_BLOCKED],
+		  (unsigned long long)c[COUNTER_SAMPLED_OUT],
+		  qs.sample_rate,
+		  ls.records,
+		  /* closed handles neither committed nor lost yet */
+		  (unsigned long long)(c[COUNTER_QUEUED] >
+				       c[COUNTER_LOGGED] + c[COUNTER_LOGGER_DROPPED] ?
+				       c[COUNTER_QUEUED] - c[COUNTER_LOGGED] -
+				       c[COUNTER_LOGGER_DROPPED] : 0),
+		  ls.batches,
+		  ls.last_commit_usec,
+		  ls.batches > 0 ? ls.commit_usec / ls.batches : 0,
+		  ls.max_commit_usec,
+		  /* interned paths, executables and hostnames */
+		  strings,
+		  load_factor);
 }
@@ -0,0 +1,327 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+/*
+ * Counts, errors and latency histograms of every file system operation,
+ * logged once per op_stats_interval.
+ *
+ * Each thread accumulates into its own set.  The set has a lock so that
+ * the logger can take it over at the end of an interval, but only its
+ * thread and, once per interval, the logger ever take it: it is never
+ * contended and shares no cache line with other threads.  Sets of
+ * exited threads are collected at the next snapshot.
+ *
+ * With op_stats_callers the operations are also counted per pid; a
+ * thread tells at most OPSTAT_CALLERS pids apart per interval, any
+ * beyond that are only in the totals.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <monfs.h>
+#include "config.h"
+#include "clock.h"
+#include "hist.h"
+#include "opstat.h"
+
+#define OPSTAT_CALLERS 32
+
+struct opstat_set {
+  pthread_mutex_t lock;
+  uint64_t used; /* bit per op recorded since the last snapshot */
+  int dead;	 /* thread exited, free at the next snapshot */
+  struct op_count ops[MONFS_OPS];
+  struct hist hist[MONFS_OPS];
+  int ncallers;
+  struct opstat_caller callers[OPSTAT_CALLERS];
+  struct opstat_set *next;
+} __attribute__((aligned(64)));
+
+static const char *op_names[MONFS_OPS] = {
+  "getattr", "readlink", "mknod", "mkdir", "unlink", "rmdir", "symlink",
+  "rename", "link", "chmod", "chown", "truncate", "open", "read", "write",
+  "statfs", "flush", "release", "fsync", "setxattr", "getxattr",
+  "listxattr", "removexattr", "opendir", "readdir", "releasedir",
+  "access", "create", "ftruncate", "fgetattr", "lock", "utimens"
+};
+
+int opstat_enabled = 0;
+static int by_caller = 0;
+
+static pthread_mutex_t sets_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct opstat_set *sets = NULL;
+static pthread_key_t opstat_key;
+static pthread_once_t opstat_key_once = PTHREAD_ONCE_INIT;
+static __thread struct opstat_set *thread_set = NULL;
+
+/* logger thread only */
+static struct opstat_snapshot snapshot;
+static unsigned long long last_snapshot;
+
+const char *
+opstat_name(int op)
+{
+  return (op >= 0 && op < MONFS_OPS ? op_names[op] : "unknown");
+}
+
+/* thread exit */
+static void
+opstat_set_release(void *arg)
+{
+  struct opstat_set *set = arg;
+
+  pthread_mutex_lock(&(set->lock));
+  set->dead = 1;
+  pthread_mutex_unlock(&(set->lock));
+}
+
+static void
+opstat_key_create()
+{
+  pthread_key_create(&opstat_key, opstat_set_release);
+}
+
+static struct opstat_set *
+opstat_set_get()
+{
+  struct opstat_set *set;
+
+  if (posix_memalign((void **)&set, 64, sizeof(*set)) != 0)
+    return NULL;
+  memset(set, 0, sizeof(*set));
+  pthread_mutex_init(&(set->lock), NULL);
+
+  pthread_once(&opstat_key_once, opstat_key_create);
+  pthread_setspecific(opstat_key, set);
+
+  pthread_mutex_lock(&sets_lock);
+  set->next = sets;
+  sets = set;
+  pthread_mutex_unlock(&sets_lock);
+
+  thread_set = set;
+  return set;
+}
+
+static struct op_count *
+set_caller(struct opstat_set *set, pid_t pid)
+{
+  struct opstat_caller *c;
+  int i;
+
+  for (i = 0; i < set->ncallers; i++) {
+    if (set->callers[i].pid == pid)
+      return set->callers[i].ops;
+  }
+
+  if (set->ncallers == OPSTAT_CALLERS)
+    return NULL;
+
+  c = &(set->callers[set->ncallers++]);
+  c->pid = pid;
+  memset(c->ops, 0, sizeof(c->ops));
+  return c->ops;
+}
+
+static void
+count_add(struct op_count *to, const struct op_count *from)
+{
+  to->count += from->count;
+  to->errors += from->errors;
+  to->nsec += from->nsec;
+}
+
+void
+opstat_record(int op, pid_t pid, unsigned long long nsec, int res)
+{
+  struct opstat_set *set = thread_set;
+  struct op_count *c;
+
+  if (op < 0 || op >= MONFS_OPS)
+    return;
+
+  if (set == NULL) {
+    set = opstat_set_get();
+    if (set == NULL)
+      return;
+  }
+
+  pthread_mutex_lock(&(set->lock));
+  set->used |= 1ULL << op;
+  c = &(set->ops[op]);
+  c->count++;
+  c->nsec += nsec;
+  if (res < 0)
+    c->errors++;
+  hist_record(&(set->hist[op]), nsec);
+
+  if (by_caller) {
+    c = set_caller(set, pid);
+    if (c != NULL) {
+      c[op].count++;
+      c[op].nsec += nsec;
+      if (res < 0)
+	c[op].errors++;
+    }
+  }
+  pthread_mutex_unlock(&(set->lock));
+}
+
+static struct opstat_caller *
+snapshot_caller(pid_t pid)
+{
+  struct opstat_caller *c;
+  unsigned long i, size;
+
+  for (i = 0; i < snapshot.ncallers; i++) {
+    if (snapshot.callers[i].pid == pid)
+      return &(snapshot.callers[i]);
+  }
+
+  if (snapshot.ncallers == snapshot.callers_size) {
+    size = (snapshot.callers_size > 0 ? snapshot.callers_size * 2 : 64);
+    c = realloc(snapshot.callers, size * sizeof(struct opstat_caller));
+    if (c == NULL)
+      return NULL;
+    snapshot.callers = c;
+    snapshot.callers_size = size;
+  }
+
+  c = &(snapshot.callers[snapshot.ncallers++]);
+  memset(c, 0, sizeof(*c));
+  c->pid = pid;
+  return c;
+}
+
+/* fold a set into the snapshot and clear it; set->lock held */
+static void
+set_flush(struct opstat_set *set)
+{
+  struct opstat_caller *c;
+  int op, i;
+
+  for (op = 0; op < MONFS_OPS; op++) {
+    if (!(set->used & (1ULL << op)))
+      continue;
+    count_add(&(snapshot.ops[op]), &(set->ops[op]));
+    hist_sum_add(&(snapshot.hist[op]), &(set->hist[op]));
+    memset(&(set->ops[op]), 0, sizeof(struct op_count));
+    hist_clear(&(set->hist[op]));
+  }
+
+  for (i = 0; i < set->ncallers; i++) {
+    c = snapshot_caller(set->callers[i].pid);
+    if (c == NULL)
+      break;
+    for (op = 0; op < MONFS_OPS; op++) {
+      if (set->used & (1ULL << op))
+	count_add(&(c->ops[op]), &(set->callers[i].ops[op]));
+    }
+  }
+
+  set->used = 0;
+  set->ncallers = 0;
+}
+
+/*
+ * Collect the operations since the last snapshot from every thread.
+ * The snapshot stays valid until the next call; NULL if there were
+ * no operations.
+ */
+struct opstat_snapshot *
+opstat_snapshot()
+{
+  struct opstat_set *set, **p;
+  unsigned long long now;
+  int op, any = 0;
+
+  for (op = 0; op < MONFS_OPS; op++) {
+    memset(&(snapshot.ops[op]), 0, sizeof(struct op_count));
+    hist_sum_clear(&(snapshot.hist[op]));
+  }
+  snapshot.ncallers = 0;
+
+  pthread_mutex_lock(&sets_lock);
+  for (p = &sets; *p != NULL; ) {
+    set = *p;
+    pthread_mutex_lock(&(set->lock));
+    if (set->used != 0) {
+      set_flush(set);
+      any = 1;
+    }
+    pthread_mutex_unlock(&(set->lock));
+
+    if (set->dead) {
+      *p = set->next;
+      pthread_mutex_destroy(&(set->lock));
+      free(set);
+    } else {
+      p = &(set->next);
+    }
+  }
+  pthread_mutex_unlock(&sets_lock);
+
+  now = monfs_clock_ns();
+  snapshot.time = monfs_clock_realtime_ns();
+  snapshot.interval = now - last_snapshot;
+  last_snapshot = now;
+
+  return (any ? &snapshot : NULL);
+}
+
+int
+opstat_init()
+{
+  by_caller = monfs_config_get_op_stats_callers();
+  last_snapshot = monfs_clock_ns();
+  opstat_enabled = (monfs_config_get_op_stats_interval() > 0);
+
+  return MONFS_OK;
+}
+
+/* no thread may be recording any more */
+void
+opstat_destroy()
+{
+  struct opstat_set *set, **p;
+
+  opstat_enabled = 0;
+
+  /* sets of live threads stay, they are still referenced */
+  pthread_mutex_lock(&sets_lock);
+  for (p = &sets; *p != NULL; ) {
+    set = *p;
+    if (set->dead) {
+      *p = set->next;
+      pthread_mutex_destroy(&(set->lock));
+      free(set);
+    } else {
+      p = &(set->next);
+    }
+  }
+  pthread_mutex_unlock(&sets_lock);
+
+  free(snapshot.callers);
+  snapshot.callers = NULL;
+  snapshot.ncallers = snapshot.callers_size = 0;
+}
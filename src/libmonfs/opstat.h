@@ -0,0 +1,61 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef OPSTAT_H_
+#define OPSTAT_H_
+
+#include <sys/types.h>
+#include <monfs.h>
+#include "hist.h"
+
+struct op_count {
+  unsigned long long count;
+  unsigned long long errors;
+  unsigned long long nsec;
+};
+
+struct opstat_caller {
+  pid_t pid;
+  const char *caller_path; /* filled in by the logger */
+  struct op_count ops[MONFS_OPS];
+};
+
+/* all operations of one interval */
+struct opstat_snapshot {
+  unsigned long long time;	/* end of the interval, nsec since the epoch */
+  unsigned long long interval;	/* nsec */
+  struct op_count ops[MONFS_OPS];
+  struct hist_sum hist[MONFS_OPS];
+  unsigned long ncallers;
+  unsigned long callers_size;
+  struct opstat_caller *callers; /* per pid, if op_stats_callers is set */
+};
+
+extern int opstat_enabled;
+
+int opstat_init();
+void opstat_destroy();
+void opstat_record(int, pid_t, unsigned long long, int);
+struct opstat_snapshot *opstat_snapshot();
+const char *opstat_name(int);
+
+#endif /* OPSTAT_H_ */
@@ -0,0 +1,405 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <monfs.h>
+#include "pool.h"
+
+/*
+ * Per-thread object pools.
+ *
+ * Every thread allocating from a pool gets its own cache with a private
+ * free list, so pool_get()/pool_put() on the same thread take no lock.
+ * Objects carry a pointer to the cache they were carved from.  Objects
+ * freed by another thread (profiles are freed by the logger) are
+ * collected into a batch per owner cache and pushed back onto the
+ * owner's lock-free "remote" stack with a single CAS; the owner reclaims the whole stack
+ * when its free list runs dry.  Memory is carved out in slabs and only
+ * returned by pool_destroy().
+ *
+ * When a thread exits its caches are orphaned and adopted by the next
+ * thread that needs one, together with their free and remote lists.
+ */
+
+#define POOL_MAX 8
+#define POOL_SLAB 32
+#define POOL_BATCH 64
+#define POOL_BATCHES 16		/* owner caches batched at once per thread */
+#define POOL_ALIGN 16
+
+struct pool_cache;
+
+struct pool_obj {
+  struct pool_cache *owner;
+  struct pool_obj *next;
+} __attribute__((aligned(POOL_ALIGN)));
+
+struct pool_slab {
+  struct pool_slab *next;
+} __attribute__((aligned(POOL_ALIGN)));
+
+struct pool_cache {
+  struct pool *pool;
+  struct pool_obj *free;
+  struct pool_obj *remote;	/* pushed by other threads */
+  struct pool_slab *slabs;
+  unsigned long long hits, misses;
+  int orphaned;
+  struct pool_cache *next;	/* in pool->caches */
+};
+
+struct pool {
+  int id;
+  size_t objsize;
+  pthread_mutex_t mutex;
+  struct pool_cache *caches;
+};
+
+/* objects freed on this thread that belong to another thread's cache */
+struct pool_batch {
+  struct pool_cache *owner;
+  struct pool_obj *head, *tail;
+  int n;
+};
+
+static struct pool *pools[POOL_MAX];
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static unsigned long pool_epoch = 1;
+
+static __thread struct pool_cache *thread_caches[POOL_MAX];
+static __thread struct pool_batch thread_batches[POOL_BATCHES];
+static __thread unsigned long thread_epoch;
+
+#define OBJ_TO_PTR(o) ((void *)((struct pool_obj *)(o) + 1))
+#define PTR_TO_OBJ(p) ((struct pool_obj *)(p) - 1)
+
+static void
+batch_flush(struct pool_batch *batch)
+{
+  struct pool_cache *owner = batch->owner;
+  struct pool_obj *head;
+
+  if (batch->n == 0)
+    return;
+
+  head = __atomic_load_n(&(owner->remote), __ATOMIC_RELAXED);
+  do {
+    batch->tail->next = head;
+  } while (!__atomic_compare_exchange_n(&(owner->remote), &head, batch->head, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  batch->owner = NULL;
+  batch->head = batch->tail = NULL;
+  batch->n = 0;
+}
+
+static void
+flush_all()
+{
+  int i;
+
+  for (i = 0; i < POOL_BATCHES; i++)
+    batch_flush(&thread_batches[i]);
+}
+
+/*
+ * The batch collecting objects of owner: its own, else an empty one,
+ * else the fullest, flushed.  Profiles and their histograms come from
+ * different pools, and closes from many threads arrive interleaved, so
+ * one batch per thread would be flushed on almost every put.
+ */
+static struct pool_batch *
+find_batch(struct pool_cache *owner)
+{
+  struct pool_batch *batch, *empty = NULL, *fullest = &thread_batches[0];
+  int i;
+
+  for (i = 0; i < POOL_BATCHES; i++) {
+    batch = &thread_batches[i];
+    if (batch->owner == owner)
+      return batch;
+    if (batch->n == 0) {
+      if (empty == NULL)
+	empty = batch;
+    } else if (batch->n > fullest->n) {
+      fullest = batch;
+    }
+  }
+
+  if (empty == NULL) {
+    batch_flush(fullest);
+    empty = fullest;
+  }
+  empty->owner = owner;
+
+  return empty;
+}
+
+static void
+thread_exit(void *arg)
+{
+  int i;
+  struct pool_cache *cache;
+
+  if (thread_epoch != __atomic_load_n(&pool_epoch, __ATOMIC_ACQUIRE))
+    return;
+
+  flush_all();
+
+  for (i = 0; i < POOL_MAX; i++) {
+    cache = thread_caches[i];
+    if (cache == NULL)
+      continue;
+    pthread_mutex_lock(&(cache->pool->mutex));
+    cache->orphaned = 1;
+    pthread_mutex_unlock(&(cache->pool->mutex));
+    thread_caches[i] = NULL;
+  }
+}
+
+static void
+thread_key_init()
+{
+  pthread_key_create(&thread_key, thread_exit);
+}
+
+/* forget caches of pools destroyed since this thread last looked */
+static void
+check_epoch()
+{
+  unsigned long epoch = __atomic_load_n(&pool_epoch, __ATOMIC_ACQUIRE);
+
+  if (thread_epoch == epoch)
+    return;
+
+  memset(thread_caches, 0, sizeof(thread_caches));
+  memset(thread_batches, 0, sizeof(thread_batches));
+  thread_epoch = epoch;
+}
+
+static struct pool_cache *
+get_cache(struct pool *pool)
+{
+  struct pool_cache *cache;
+
+  check_epoch();
+  cache = thread_caches[pool->id];
+  if (cache != NULL)
+    return cache;
+
+  pthread_mutex_lock(&(pool->mutex));
+  for (cache = pool->caches; cache != NULL; cache = cache->next) {
+    if (cache->orphaned) {
+      cache->orphaned = 0;
+      break;
+    }
+  }
+  if (cache == NULL) {
+    cache = calloc(1, sizeof(*cache));
+    if (cache != NULL) {
+      cache->pool = pool;
+      cache->next = pool->caches;
+      pool->caches = cache;
+    }
+  }
+  pthread_mutex_unlock(&(pool->mutex));
+
+  if (cache == NULL)
+    return NULL;
+
+  pthread_once(&thread_key_once, thread_key_init);
+  pthread_setspecific(thread_key, (void *)1); /* arm thread_exit() */
+  thread_caches[pool->id] = cache;
+
+  return cache;
+}
+
+static int
+cache_refill(struct pool_cache *cache)
+{
+  struct pool_slab *slab;
+  struct pool_obj *obj;
+  size_t size = sizeof(struct pool_obj) + cache->pool->objsize;
+  int i;
+
+  /* take back everything other threads have returned */
+  cache->free = __atomic_exchange_n(&(cache->remote), NULL, __ATOMIC_ACQUIRE);
+  if (cache->free != NULL)
+    return 1;
+
+  slab = malloc(sizeof(*slab) + size * POOL_SLAB);
+  if (slab == NULL)
+    return 0;
+  slab->next = cache->slabs;
+  cache->slabs = slab;
+
+  for (i = POOL_SLAB - 1; i >= 0; i--) {
+    obj = (struct pool_obj *)((char *)(slab + 1) + size * i);
+    obj->owner = cache;
+    obj->next = cache->free;
+    cache->free = obj;
+  }
+  return -1;
+}
+
+struct pool *
+pool_create(size_t objsize)
+{
+  struct pool *pool;
+  int i;
+
+  pool = malloc(sizeof(*pool));
+  if (pool == NULL)
+    return NULL;
+
+  pool->objsize = (objsize + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+  pool->caches = NULL;
+  pthread_mutex_init(&(pool->mutex), NULL);
+
+  pthread_mutex_lock(&pools_mutex);
+  for (i = 0; i < POOL_MAX && pools[i] != NULL; i++)
+    ;
+  if (i < POOL_MAX)
+    pools[i] = pool;
+  pthread_mutex_unlock(&pools_mutex);
+
+  if (i == POOL_MAX) {
+    pthread_mutex_destroy(&(pool->mutex));
+    free(pool);
+    return NULL;
+  }
+  pool->id = i;
+
+  return pool;
+}
+
+/* all objects must have been returned and no thread may use the pool */
+void
+pool_destroy(struct pool *pool)
+{
+  struct pool_cache *cache, *next_cache;
+  struct pool_slab *slab, *next_slab;
+
+  if (pool == NULL)
+    return;
+
+  __atomic_add_fetch(&pool_epoch, 1, __ATOMIC_RELEASE);
+
+  pthread_mutex_lock(&pools_mutex);
+  pools[pool->id] = NULL;
+  pthread_mutex_unlock(&pools_mutex);
+
+  for (cache = pool->caches; cache != NULL; cache = next_cache) {
+    next_cache = cache->next;
+    for (slab = cache->slabs; slab != NULL; slab = next_slab) {
+      next_slab = slab->next;
+      free(slab);
+    }
+    free(cache);
+  }
+  pthread_mutex_destroy(&(pool->mutex));
+  free(pool);
+}
+
+void *
+pool_get(struct pool *pool)
+{
+  struct pool_cache *cache;
+  struct pool_obj *obj;
+  int res = 1;
+
+  cache = get_cache(pool);
+  if (cache == NULL)
+    return NULL;
+
+  if (cache->free == NULL) {
+    res = cache_refill(cache);
+    if (res == 0)
+      return NULL;
+  }
+
+  obj = cache->free;
+  cache->free = obj->next;
+  if (res > 0)
+    __atomic_store_n(&(cache->hits), cache->hits + 1, __ATOMIC_RELAXED);
+  else
+    __atomic_store_n(&(cache->misses), cache->misses + 1, __ATOMIC_RELAXED);
+
+  return OBJ_TO_PTR(obj);
+}
+
+void
+pool_put(void *ptr)
+{
+  struct pool_obj *obj;
+  struct pool_cache *owner;
+  struct pool_batch *batch;
+
+  if (ptr == NULL)
+    return;
+
+  obj = PTR_TO_OBJ(ptr);
+  owner = obj->owner;
+
+  check_epoch();
+  if (thread_caches[owner->pool->id] == owner) {
+    obj->next = owner->free;
+    owner->free = obj;
+    return;
+  }
+
+  batch = find_batch(owner);
+  obj->next = batch->head;
+  batch->head = obj;
+  if (batch->tail == NULL)
+    batch->tail = obj;
+  if (++batch->n >= POOL_BATCH)
+    batch_flush(batch);
+}
+
+/* hand objects freed on this thread back to their owners now */
+void
+pool_flush()
+{
+  check_epoch();
+  flush_all();
+}
+
+void
+pool_get_stats(struct pool *pool, struct pool_stats *stats)
+{
+  struct pool_cache *cache;
+
+  memset(stats, 0, sizeof(*stats));
+
+  pthread_mutex_lock(&(pool->mutex));
+  for (cache = pool->caches; cache != NULL; cache = cache->next) {
+    stats->hits += __atomic_load_n(&(cache->hits), __ATOMIC_RELAXED);
+    stats->misses += __atomic_load_n(&(cache->misses), __ATOMIC_RELAXED);
+    stats->threads++;
+  }
+  pthread_mutex_unlock(&(pool->mutex));
+}
@@ -0,0 +1,43 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stddef.h>
+
+struct pool;
+
+struct pool_stats {
+  unsigned long long hits;	/* served without touching the heap */
+  unsigned long long misses;	/* had to malloc a new slab */
+  unsigned long threads;
+};
+
+struct pool * pool_create(size_t);
+void pool_destroy(struct pool *);
+void *pool_get(struct pool *);
+void pool_put(void *);
+void pool_flush();
+void pool_get_stats(struct pool *, struct pool_stats *);
+
+#endif /* POOL_H_ */
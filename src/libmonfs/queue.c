@@ -21,187 +21,270 @@
  */
 
 #include <stdlib.h>
-#include <pthread.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <monfs.h>
 #include "queue.h"
 
-struct queue_node {
+/*
+ * Bounded multi-producer/single-consumer ring buffer.
+ *
+ * Each slot carries a sequence number: a producer owns slot (pos & mask)
+ * when seq == pos, and publishes it by setting seq = pos + 1; the consumer
+ * releases it to the next lap by setting seq = pos + capacity.  Producers
+ * only claim a position with a CAS on tail, so enqueue never allocates or
+ * blocks.  The consumer sleeps on a futex and producers only issue a wakeup
+ * when it has announced that it is going to sleep.
+ */
+
+#define CACHELINE 64
+
+struct queue_slot {
+  unsigned long seq;
   void *data;
-  struct queue_node *next;
 };
 
 struct queue {
-  pthread_mutex_t mutex;
-  pthread_cond_t cond;
-  pthread_mutex_t cond_mutex;
-  struct queue_node *head;
-  struct queue_node **tail_p;
+  struct queue_slot *slots;
+  unsigned long mask;
+
+  unsigned long tail __attribute__((aligned(CACHELINE))); /* producers */
+
+  unsigned long head __attribute__((aligned(CACHELINE))); /* consumer */
+  int sleeping;
+  int wakeups;
+  int closed;
+
+  /* producers waiting for a free slot, see enqueue_wait() */
+  int blocked __attribute__((aligned(CACHELINE)));
+  int freed;
 };
 
+static int
+futex_wait(int *addr, int val, const struct timespec *timeout)
+{
+  return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+static void
+futex_wake(int *addr, int n)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+static void
+wake_consumer(struct queue *queue)
+{
+  __atomic_add_fetch(&(queue->wakeups), 1, __ATOMIC_SEQ_CST);
+  futex_wake(&(queue->wakeups), 1);
+}
+
+static int
+is_empty(struct queue *queue)
+{
+  struct queue_slot *slot = &(queue->slots[queue->head & queue->mask]);
+
+  return (__atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE) != queue->head + 1);
+}
+
 int
-queue_alloc(struct queue **queue_p)
+queue_alloc(struct queue **queue_p, unsigned long size)
 {
-  int res;
   struct queue *queue;
+  unsigned long i, capacity;
+
+  for (capacity = 2; capacity < size; capacity <<= 1)
+    ;
+
+  if (posix_memalign((void **)&queue, CACHELINE, sizeof(*queue)) != 0)
+    return ENOMEM;
 
-  queue = malloc(sizeof *queue);
-  if (queue == NULL) {
-    res = ENOMEM;
-    goto error;
+  queue->slots = malloc(sizeof(struct queue_slot) * capacity);
+  if (queue->slots == NULL) {
+    free(queue);
+    return ENOMEM;
+  }
+
+  for (i = 0; i < capacity; i++) {
+    queue->slots[i].seq = i;
+    queue->slots[i].data = NULL;
   }
-	
-  queue->head = NULL;
-  queue->tail_p = &(queue->head);
-	
-  res = pthread_mutex_init(&(queue->mutex), NULL);
-  if (res != 0)
-    goto error_mutex;
-
-  res = pthread_cond_init(&(queue->cond), NULL);
-  if (res != 0)
-    goto error_cond;
-	
-  res = pthread_mutex_init(&(queue->cond_mutex), NULL);
-  if (res != 0)
-    goto error_cond_mutex;
-	
+  queue->mask = capacity - 1;
+  queue->tail = 0;
+  queue->head = 0;
+  queue->sleeping = 0;
+  queue->wakeups = 0;
+  queue->closed = 0;
+  queue->blocked = 0;
+  queue->freed = 0;
+
   *queue_p = queue;
-	
+
   return 0;
-	
-  /** error **/
- error_cond_mutex:
-  pthread_cond_destroy(&(queue->cond));
- error_cond:		
-  pthread_mutex_destroy(&(queue->mutex));
- error_mutex:		
-  free(queue);
- error:
-  return res;
 }
 
 void
 queue_free(struct queue *queue, free_func_t free_func)
 {
-  struct queue_node *cursor, *tmp;
-	
-  pthread_mutex_destroy(&(queue->cond_mutex));
-  pthread_cond_destroy(&(queue->cond));
-  pthread_mutex_destroy(&(queue->mutex));
-	
-  cursor = queue->head;
-  while(cursor) {
+  void *data;
+
+  if (queue == NULL)
+    return;
+
+  for (;;) {
+    data = NULL;
+    dequeue(queue, &data);
+    if (data == NULL)
+      break;
     if (free_func)
-      free_func(cursor->data);
-    tmp = cursor->next;
-    free(cursor);
-    cursor = tmp;
+      free_func(data);
   }
-	
+
+  free(queue->slots);
   free(queue);
 }
 
 int
 enqueue(struct queue *queue, void *data)
 {
-  int res, res_save = 0;
-  struct queue_node *node = NULL;
-  int canceltype;
-	
-  node = malloc(sizeof(*node));
-  if (node == NULL)
-    return ENOMEM;
-	
-  node->data = data;
-  node->next = NULL;
-	
-  res = pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, &canceltype);
-  if (res != 0)
-    return res;
-
-  /* Lock dispatch mutex, add node to dispatch queue, unlock mutex */
-  res = pthread_mutex_lock(&queue->mutex);
-  if (res != 0) {
-    free(node);
-    return res;
+  struct queue_slot *slot;
+  unsigned long pos, seq;
+  long diff;
+
+  pos = __atomic_load_n(&(queue->tail), __ATOMIC_RELAXED);
+  for (;;) {
+    slot = &(queue->slots[pos & queue->mask]);
+    seq = __atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE);
+    diff = (long)seq - (long)pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&(queue->tail), &pos, pos + 1, 1,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	break;
+    } else if (diff < 0) {
+      return EAGAIN; /* full */
+    } else {
+      pos = __atomic_load_n(&(queue->tail), __ATOMIC_RELAXED);
+    }
   }
-	
-  *(queue->tail_p) = node;
-  queue->tail_p = &(node->next);
-	
-  res = pthread_mutex_unlock(&(queue->mutex));
-  if (res != 0)
-    return res;
-
-  /* Signal dispatch condition */
-  res = pthread_mutex_lock(&(queue->cond_mutex));
-  if (res != 0)
-    return res;
-	
-  res = pthread_cond_signal(&(queue->cond));
-  if (res != 0)
-    res_save = res;
-	
-  res = pthread_mutex_unlock(&(queue->cond_mutex));
-	
-  return (res_save != 0 ? res_save : res);
+
+  slot->data = data;
+  __atomic_store_n(&(slot->seq), pos + 1, __ATOMIC_RELEASE);
+
+  /* pairs with the fence in queue_wait() */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&(queue->sleeping), __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(&(queue->sleeping), 0, __ATOMIC_RELAXED))
+    wake_consumer(queue);
+
+  return 0;
 }
 
+/*
+ * Like enqueue(), but wait for the consumer to free a slot rather than
+ * fail when the queue is full.  Gives up with EAGAIN once the queue is
+ * closed.
+ */
 int
-dequeue(struct queue *queue, void **data)
+enqueue_wait(struct queue *queue, void *data)
 {
-  int res, res_save = 0;
-  struct queue_node *node;
-  int canceltype;
-	
-  res = pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, &canceltype);
-  if (res != 0)
-    return res;
-
-  /* Lock dispatch mutex, pop node, unlock mutex */
-  res = pthread_mutex_lock(&(queue->mutex));
-  if (res != 0)
-    return res;
-	
-  if (queue->head) {
-    node = queue->head;
-    queue->head = node->next;
-    if (!queue->head)
-      queue->tail_p = &(queue->head);
-  } else {
-    node = NULL;
+  struct timespec timeout = { 0, 100000000L }; /* recheck closed */
+  int freed, res;
+
+  for (;;) {
+    freed = __atomic_load_n(&(queue->freed), __ATOMIC_SEQ_CST);
+    res = enqueue(queue, data);
+    if (res != EAGAIN || queue_is_closed(queue))
+      return res;
+
+    __atomic_add_fetch(&(queue->blocked), 1, __ATOMIC_SEQ_CST);
+    /* pairs with the fence in dequeue() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (queue_length(queue) > queue->mask)
+      futex_wait(&(queue->freed), freed, &timeout);
+    __atomic_sub_fetch(&(queue->blocked), 1, __ATOMIC_SEQ_CST);
   }
+}
 
-  res = pthread_mutex_unlock(&(queue->mutex));
-  if (res != 0)
-    res_save = res;
-	
-  res = pthread_setcanceltype(canceltype, &canceltype);
+/* single consumer only; *data is left untouched when the queue is empty */
+int
+dequeue(struct queue *queue, void **data)
+{
+  unsigned long head = queue->head;
+  struct queue_slot *slot = &(queue->slots[head & queue->mask]);
+
+  if (__atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE) != head + 1)
+    return 0;
+
+  *data = slot->data;
+  __atomic_store_n(&(slot->seq), head + queue->mask + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&(queue->head), head + 1, __ATOMIC_RELEASE);
 
-  if (node) {
-    *data = node->data;
-    free(node);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&(queue->blocked), __ATOMIC_RELAXED)) {
+    __atomic_add_fetch(&(queue->freed), 1, __ATOMIC_SEQ_CST);
+    futex_wake(&(queue->freed), INT_MAX);
   }
-	
-  return (res_save != 0 ? res_save : res);
+
+  return 0;
 }
 
+/*
+ * Wait until the queue is non-empty or closed, or at most msec if
+ * msec >= 0.
+ */
 int
-queue_wait(struct queue *queue)
+queue_wait(struct queue *queue, long msec)
 {
-  int wait_error = 0;
-	
-  if (pthread_mutex_lock(&(queue->cond_mutex)) != 0)
-    return -1;
-	
-  pthread_cleanup_push((void (*)(void *))pthread_mutex_unlock,
-		       (void *)&(queue->cond_mutex));
-  while (!wait_error && !queue->head) {
-    if (pthread_cond_wait(&(queue->cond), &(queue->cond_mutex)) != 0)
-      wait_error = -1;
+  int wakeups, res = 0;
+  struct timespec timeout;
+
+  timeout.tv_sec = msec / 1000;
+  timeout.tv_nsec = (msec % 1000) * 1000000L;
+
+  wakeups = __atomic_load_n(&(queue->wakeups), __ATOMIC_SEQ_CST);
+  if (!is_empty(queue) || __atomic_load_n(&(queue->closed), __ATOMIC_SEQ_CST))
+    return 0;
+
+  __atomic_store_n(&(queue->sleeping), 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (is_empty(queue)) {
+    if (futex_wait(&(queue->wakeups), wakeups,
+		   msec >= 0 ? &timeout : NULL) == -1 &&
+	errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+      res = -1;
   }
-  pthread_cleanup_pop(1);
-	
-  return wait_error;
+  __atomic_store_n(&(queue->sleeping), 0, __ATOMIC_RELAXED);
+
+  return res;
 }
 
+/* make queue_wait() return for good; entries may still be dequeued */
+void
+queue_close(struct queue *queue)
+{
+  __atomic_store_n(&(queue->closed), 1, __ATOMIC_SEQ_CST);
+  wake_consumer(queue);
+}
+
+int
+queue_is_closed(struct queue *queue)
+{
+  return __atomic_load_n(&(queue->closed), __ATOMIC_SEQ_CST);
+}
+
+unsigned long
+queue_capacity(struct queue *queue)
+{
+  return queue->mask + 1;
+}
+
+unsigned long
+queue_length(struct queue *queue)
+{
+  return __atomic_load_n(&(queue->tail), __ATOMIC_RELAXED) -
+    __atomic_load_n(&(queue->head), __ATOMIC_RELAXED);
+}
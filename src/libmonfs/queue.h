@@ -25,11 +25,16 @@
 
 struct queue;
 
-int queue_alloc(struct queue **);
+int queue_alloc(struct queue **, unsigned long);
 typedef void free_func_t(void *);
 void queue_free(struct queue *queue, free_func_t free_func);
 int enqueue(struct queue *queue, void *data);
+int enqueue_wait(struct queue *queue, void *data);
 int dequeue(struct queue *queue, void **data);
-int queue_wait(struct queue *queue);
+int queue_wait(struct queue *queue, long msec);
+void queue_close(struct queue *queue);
+int queue_is_closed(struct queue *queue);
+unsigned long queue_capacity(struct queue *queue);
+unsigned long queue_length(struct queue *queue);
 
 #endif /*QUEUE_H_*/
@@ -0,0 +1,262 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <monfs.h>
+#include "hash.h"
+#include "strtab.h"
+
+/*
+ * Reference counted table of interned strings (paths, executables and
+ * hostnames).  Equal strings share one copy, and profiles only hold
+ * pointers into the table.
+ *
+ * The table is keyed by the string pointer itself, hashed and compared
+ * by content, so every string is stored once.  The refcount goes from
+ * 1 to 0 and from 0 to 1 only under the shard lock; other changes are
+ * lock-free.
+ */
+
+#define STRTAB_SHARDS 16
+#define STRTAB_SIZE 256 /* initial size per shard */
+
+struct interned {
+  unsigned long refcnt;
+  uint64_t hash;
+  unsigned long id_gen;
+  long long id;
+  char str[1];
+};
+
+#define STR_TO_INTERNED(s) \
+  ((struct interned *)((char *)(s) - offsetof(struct interned, str)))
+
+struct strtab_shard {
+  pthread_mutex_t lock;
+  struct hash_table *ht;
+} __attribute__((aligned(64)));
+
+static struct strtab_shard strtab[STRTAB_SHARDS];
+
+static const char *
+key_string(const void *key)
+{
+  const char *s;
+
+  memcpy(&s, key, sizeof(s));
+  return s;
+}
+
+static uint64_t
+hash_string(const void *key, int keylen)
+{
+  const char *s = key_string(key);
+
+  return hash_default(s, strlen(s));
+}
+
+static int
+equal_string(const void *key1, int key1len, const void *key2, int key2len)
+{
+  return (strcmp(key_string(key1), key_string(key2)) == 0);
+}
+
+static struct strtab_shard *
+get_shard(uint64_t hash)
+{
+  return &strtab[hash >> 60];
+}
+
+int
+strtab_init()
+{
+  int i;
+
+  for (i = 0; i < STRTAB_SHARDS; i++) {
+    strtab[i].ht = hash_table_alloc(STRTAB_SIZE, hash_string, equal_string);
+    if (strtab[i].ht == NULL)
+      goto error;
+    pthread_mutex_init(&(strtab[i].lock), NULL);
+  }
+  return MONFS_OK;
+
+ error:
+  while (--i >= 0) {
+    pthread_mutex_destroy(&(strtab[i].lock));
+    hash_table_free(strtab[i].ht);
+  }
+  return MONFS_ERR_NO_MEMORY;
+}
+
+/* strings still referenced at this point are leaked */
+void
+strtab_destroy()
+{
+  int i;
+
+  for (i = 0; i < STRTAB_SHARDS; i++) {
+    pthread_mutex_destroy(&(strtab[i].lock));
+    hash_table_free(strtab[i].ht);
+    strtab[i].ht = NULL;
+  }
+}
+
+unsigned long
+strtab_count()
+{
+  int i;
+  unsigned long n = 0;
+
+  for (i = 0; i < STRTAB_SHARDS; i++) {
+    pthread_mutex_lock(&(strtab[i].lock));
+    n += hash_table_count(strtab[i].ht);
+    pthread_mutex_unlock(&(strtab[i].lock));
+  }
+  return n;
+}
+
+/* mean over the shards of their hash table load factors */
+double
+strtab_load_factor()
+{
+  int i;
+  double lf = 0;
+
+  for (i = 0; i < STRTAB_SHARDS; i++) {
+    pthread_mutex_lock(&(strtab[i].lock));
+    lf += hash_table_load_factor(strtab[i].ht);
+    pthread_mutex_unlock(&(strtab[i].lock));
+  }
+  return lf / STRTAB_SHARDS;
+}
+
+const char *
+str_intern(const char *s)
+{
+  struct strtab_shard *shard;
+  struct hash_entry *entry;
+  struct interned *in;
+  const char *key;
+  uint64_t hash;
+  size_t len;
+  int created;
+
+  if (s == NULL)
+    return NULL;
+
+  len = strlen(s);
+  hash = hash_default(s, len);
+  shard = get_shard(hash);
+
+  pthread_mutex_lock(&(shard->lock));
+  entry = hash_lookup(shard->ht, &s, sizeof(s));
+  if (entry != NULL) {
+    in = STR_TO_INTERNED(key_string(hash_entry_key(entry)));
+    __atomic_add_fetch(&(in->refcnt), 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&(shard->lock));
+    return in->str;
+  }
+
+  in = malloc(offsetof(struct interned, str) + len + 1);
+  if (in == NULL) {
+    pthread_mutex_unlock(&(shard->lock));
+    return NULL;
+  }
+  in->refcnt = 1;
+  in->hash = hash;
+  in->id_gen = 0;
+  in->id = 0;
+  memcpy(in->str, s, len + 1);
+
+  key = in->str;
+  entry = hash_enter(shard->ht, &key, sizeof(key), 0, &created);
+  pthread_mutex_unlock(&(shard->lock));
+
+  if (entry == NULL) {
+    free(in);
+    return NULL;
+  }
+
+  return in->str;
+}
+
+/* take another reference on an interned string the caller holds */
+const char *
+str_ref(const char *s)
+{
+  if (s != NULL)
+    __atomic_add_fetch(&(STR_TO_INTERNED(s)->refcnt), 1, __ATOMIC_RELAXED);
+  return s;
+}
+
+void
+str_release(const char *s)
+{
+  struct interned *in;
+  struct strtab_shard *shard;
+  unsigned long refcnt;
+
+  if (s == NULL)
+    return;
+
+  in = STR_TO_INTERNED(s);
+
+  refcnt = __atomic_load_n(&(in->refcnt), __ATOMIC_RELAXED);
+  while (refcnt > 1) {
+    if (__atomic_compare_exchange_n(&(in->refcnt), &refcnt, refcnt - 1, 1,
+				    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      return;
+  }
+
+  /* possibly the last reference */
+  shard = get_shard(in->hash);
+  pthread_mutex_lock(&(shard->lock));
+  if (__atomic_sub_fetch(&(in->refcnt), 1, __ATOMIC_ACQ_REL) == 0) {
+    hash_purge(shard->ht, &s, sizeof(s));
+    free(in);
+  }
+  pthread_mutex_unlock(&(shard->lock));
+}
+
+/*
+ * The logger caches the database id of a string here.  gen identifies
+ * the database the id belongs to; a mismatch reads as "unknown" (0).
+ */
+long long
+str_get_id(const char *s, unsigned long gen)
+{
+  struct interned *in = STR_TO_INTERNED(s);
+
+  return (in->id_gen == gen ? in->id : 0);
+}
+
+void
+str_set_id(const char *s, unsigned long gen, long long id)
+{
+  struct interned *in = STR_TO_INTERNED(s);
+
+  in->id_gen = gen;
+  in->id = id;
+}
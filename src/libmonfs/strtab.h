@@ -0,0 +1,39 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#ifndef STRTAB_H_
+#define STRTAB_H_
+
+int strtab_init();
+void strtab_destroy();
+unsigned long strtab_count();
+double strtab_load_factor();
+
+const char *str_intern(const char *);
+const char *str_ref(const char *);
+void str_release(const char *);
+
+/* per-string id slot, owned by the logger */
+long long str_get_id(const char *, unsigned long);
+void str_set_id(const char *, unsigned long, long long);
+
+#endif /* STRTAB_H_ */
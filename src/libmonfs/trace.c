@@ -0,0 +1,312 @@
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <monfs.h>
+#include <monfs_trace.h>
+#include "clock.h"
+#include "error.h"
+#include "trace.h"
+
+/*
+ * Per-operation event trace.
+ *
+ * Events are written into a per-thread buffer; a full buffer reserves
+ * its slots in the ring with one atomic add and is copied into the
+ * mmap'd trace file, see include/monfs_trace.h for the layout.
+ * Segments are mapped, and the file extended, on first use.
+ */
+
+#define TRACE_BUF_EVENTS 256
+#define SEGMENT_BYTES \
+  ((size_t)MONFS_TRACE_SEGMENT_EVENTS * sizeof(struct monfs_trace_event))
+
+struct trace_buf {
+  struct monfs_trace_event ev[TRACE_BUF_EVENTS];
+  unsigned int n;
+  uint32_t tid;
+  int attached;			/* on the bufs list */
+  struct trace_buf *next;
+};
+
+int tracing = 0;
+
+static int trace_fd = -1;
+static struct monfs_trace_header *header = NULL;
+static char **segments = NULL;
+static unsigned long nsegments;
+static uint64_t capacity;
+static uint64_t next_event;
+
+static pthread_mutex_t segment_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t bufs_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_buf *bufs = NULL;
+static pthread_key_t trace_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static __thread struct trace_buf *thread_buf = NULL;
+
+static char *
+get_segment(unsigned long k)
+{
+  char *seg;
+
+  seg = __atomic_load_n(&(segments[k]), __ATOMIC_ACQUIRE);
+  if (seg != NULL)
+    return seg;
+
+  pthread_mutex_lock(&segment_lock);
+  seg = segments[k];
+  if (seg == NULL && trace_fd != -1) {
+    /* allocate the blocks, so that a full disk fails here, not as SIGBUS */
+    if (posix_fallocate(trace_fd,
+			MONFS_TRACE_HEADER_SIZE + (off_t)k * SEGMENT_BYTES,
+			SEGMENT_BYTES) == 0) {
+      seg = mmap(NULL, SEGMENT_BYTES, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_POPULATE,
+		 trace_fd, MONFS_TRACE_HEADER_SIZE + (off_t)k * SEGMENT_BYTES);
+      if (seg == MAP_FAILED)
+	seg = NULL;
+    }
+    if (seg == NULL)
+      monfs_msg("trace : can't extend the trace file, events dropped");
+    else
+      __atomic_store_n(&(segments[k]), seg, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&segment_lock);
+
+  return seg;
+}
+
+static void
+trace_flush(struct trace_buf *b)
+{
+  uint64_t idx, written;
+  unsigned int i = 0, chunk;
+  unsigned long pos;
+  char *seg;
+
+  if (b->n == 0)
+    return;
+
+  idx = __atomic_fetch_add(&next_event, b->n, __ATOMIC_RELAXED);
+
+  while (i < b->n) {
+    pos = (idx + i) % capacity;
+    chunk = MONFS_TRACE_SEGMENT_EVENTS - pos % MONFS_TRACE_SEGMENT_EVENTS;
+    if (chunk > b->n - i)
+      chunk = b->n - i;
+
+    seg = get_segment(pos / MONFS_TRACE_SEGMENT_EVENTS);
+    if (seg != NULL)
+      memcpy(seg + (pos % MONFS_TRACE_SEGMENT_EVENTS) *
+	     sizeof(struct monfs_trace_event),
+	     &(b->ev[i]), chunk * sizeof(struct monfs_trace_event));
+    i += chunk;
+  }
+
+  written = __atomic_load_n(&(header->written), __ATOMIC_RELAXED);
+  while (written < idx + b->n &&
+	 !__atomic_compare_exchange_n(&(header->written), &written,
+				      idx + b->n, 1,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+
+  b->n = 0;
+}
+
+/* thread exit */
+static void
+trace_buf_release(void *arg)
+{
+  struct trace_buf *b = arg, **p;
+
+  pthread_mutex_lock(&bufs_lock);
+  if (b->attached) {
+    trace_flush(b);
+    for (p = &bufs; *p != NULL; p = &((*p)->next)) {
+      if (*p == b) {
+	*p = b->next;
+	break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&bufs_lock);
+
+  free(b);
+}
+
+static void
+trace_key_create()
+{
+  pthread_key_create(&trace_key, trace_buf_release);
+}
+
+static struct trace_buf *
+trace_buf_get()
+{
+  struct trace_buf *b = thread_buf;
+
+  if (b != NULL && b->attached)
+    return b;
+
+  if (b == NULL) {
+    b = malloc(sizeof(*b));
+    if (b == NULL)
+      return NULL;
+    b->tid = (uint32_t)syscall(SYS_gettid);
+    thread_buf = b;
+    pthread_setspecific(trace_key, b);
+  }
+
+  b->n = 0;
+  pthread_mutex_lock(&bufs_lock);
+  b->attached = 1;
+  b->next = bufs;
+  bufs = b;
+  pthread_mutex_unlock(&bufs_lock);
+
+  return b;
+}
+
+void
+trace_event(int op, uint64_t handle, int64_t offset, uint64_t size,
+	    uint64_t latency, pid_t pid)
+{
+  struct trace_buf *b;
+  struct monfs_trace_event *e;
+
+  b = trace_buf_get();
+  if (b == NULL)
+    return;
+
+  e = &(b->ev[b->n++]);
+  e->time_ns = monfs_clock_ns();
+  e->handle = handle;
+  e->offset = offset;
+  e->latency_ns = latency;
+  e->size = (uint32_t)size;
+  e->tid = b->tid;
+  e->pid = (uint32_t)pid;
+  e->op = (uint16_t)op;
+  e->reserved = 0;
+
+  if (b->n == TRACE_BUF_EVENTS)
+    trace_flush(b);
+}
+
+int
+trace_init(const char *path, int size_mb)
+{
+  pthread_once(&trace_key_once, trace_key_create);
+
+  nsegments = ((unsigned long)size_mb << 20) / SEGMENT_BYTES;
+  if (nsegments == 0)
+    nsegments = 1;
+  capacity = (uint64_t)nsegments * MONFS_TRACE_SEGMENT_EVENTS;
+  next_event = 0;
+
+  segments = calloc(nsegments, sizeof(char *));
+  if (segments == NULL)
+    return MONFS_ERR_NO_MEMORY;
+
+  trace_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (trace_fd == -1)
+    goto error;
+
+  if (ftruncate(trace_fd, MONFS_TRACE_HEADER_SIZE) == -1)
+    goto error;
+
+  header = mmap(NULL, MONFS_TRACE_HEADER_SIZE, PROT_READ | PROT_WRITE,
+		MAP_SHARED, trace_fd, 0);
+  if (header == MAP_FAILED) {
+    header = NULL;
+    goto error;
+  }
+
+  memcpy(header->magic, MONFS_TRACE_MAGIC, sizeof(header->magic));
+  header->version = MONFS_TRACE_VERSION;
+  header->event_size = sizeof(struct monfs_trace_event);
+  header->segment_events = MONFS_TRACE_SEGMENT_EVENTS;
+  header->capacity = capacity;
+  header->written = 0;
+  header->realtime_offset =
+    (int64_t)(monfs_clock_realtime_ns() - monfs_clock_ns());
+
+  tracing = 1;
+
+  return MONFS_OK;
+
+ error:
+  monfs_err_msg(MONFS_ERR_LOGGER_INIT, NULL);
+  if (trace_fd != -1)
+    close(trace_fd);
+  trace_fd = -1;
+  free(segments);
+  segments = NULL;
+  return MONFS_ERR_LOGGER_INIT;
+}
+
+void
+trace_destroy()
+{
+  struct trace_buf *b;
+  unsigned long k;
+  char buf[256];
+
+  if (!tracing)
+    return;
+  tracing = 0;
+
+  /* threads still around keep their buffer; it is freed at their exit */
+  pthread_mutex_lock(&bufs_lock);
+  while ((b = bufs) != NULL) {
+    bufs = b->next;
+    trace_flush(b);
+    b->attached = 0;
+  }
+  pthread_mutex_unlock(&bufs_lock);
+
+  snprintf(buf, sizeof(buf), "trace : %llu events%s",
+	   (unsigned long long)header->written,
+	   header->written > capacity ? " (ring wrapped)" : "");
+  monfs_msg(buf);
+
+  pthread_mutex_lock(&segment_lock);
+  for (k = 0; k < nsegments; k++) {
+    if (segments[k] != NULL)
+      munmap(segments[k], SEGMENT_BYTES);
+  }
+  free(segments);
+  segments = NULL;
+  munmap(header, MONFS_TRACE_HEADER_SIZE);
+  header = NULL;
+  close(trace_fd);
+  trace_fd = -1;
+  pthread_mutex_unlock(&segment_lock);
+}
@@ -21,16 +21,19 @@
  * See the file COPYING.
  */
 
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 29
+#define _GNU_SOURCE
 
 #include <fuse.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #ifdef ULOCKMGR
 #include <ulockmgr.h>
@@ -47,7 +50,11 @@
  */
 char *db_filename = NULL; //"/tmp/monfs.db";
 char *monfs_root = NULL; //"";
+#ifndef MONFS_NO_MONITOR
 int monitor_flag = 1;
+#else
+int monitor_flag = 0; /* configured with --disable-monitor */
+#endif
 
 static int monfs_root_fd = -1;
 
@@ -60,21 +67,139 @@ is_absolute_path(const char *path)
     return 0;
 }
 
-static char *
+/*
+ * Every path is resolved with the *at() calls relative to monfs_root_fd,
+ * so neither an allocation nor the process cwd is involved.  FUSE paths
+ * always start with '/'.
+ */
+static inline const char *
 get_relative_monfs_path(const char *path)
 {
-  char *relative_monfs_path;
+  return path[1] == '\0' ? "." : path + 1;
+}
+
+#ifdef HAVE_SETXATTR
+/*
+ * There are no *at() variants of the xattr calls; reach the file
+ * through the root fd in /proc instead.
+ */
+static int
+get_proc_monfs_path(char *buf, size_t size, const char *path)
+{
   int len;
-	
-  len = strlen(path) + 2;
-  relative_monfs_path = malloc(sizeof(char) * len);
-  if (relative_monfs_path == NULL)
-    return NULL;
-	
-  snprintf(relative_monfs_path, len, ".%s", path);
-  relative_monfs_path[len - 1] = '\0';
 
-  return relative_monfs_path; 
+  len = snprintf(buf, size, "/proc/self/fd/%d/%s", monfs_root_fd,
+		 get_relative_monfs_path(path));
+  if (len < 0 || (size_t)len >= size)
+    return -ENAMETOOLONG;
+
+  return 0;
+}
+#endif
+
+static inline struct monfs_file *
+get_file(struct fuse_file_info *fi)
+{
+  return (struct monfs_file *) (uintptr_t) fi->fh;
+}
+
+static inline DIR *
+get_dirp(struct fuse_file_info *fi)
+{
+  return (DIR *) (uintptr_t) fi->fh;
+}
+
+#ifndef MONFS_NO_MONITOR
+/* account an operation started at t1 and pass its result on */
+static inline int
+op_done(int op, unsigned long long t1, int res)
+{
+  monfs_monitor_op(op, fuse_get_context()->pid, monfs_monitor_clock() - t1,
+		   res);
+  return res;
+}
+
+/*
+ * Live statistics: a read-only /.monfs directory holding "stats", see
+ * monfs_monitor_stats().  It is not listed in the root directory, and
+ * hides a /.monfs of the backing file system.
+ */
+#define STATS_DIR "/.monfs"
+#define STATS_FILE STATS_DIR "/stats"
+#define STATS_SIZE 4096
+
+static time_t mount_time;
+
+static int
+is_stats_path(const char *path)
+{
+  return (strncmp(path, STATS_DIR, sizeof(STATS_DIR) - 1) == 0 &&
+	  (path[sizeof(STATS_DIR) - 1] == '\0' ||
+	   path[sizeof(STATS_DIR) - 1] == '/'));
+}
+
+static int
+stats_getattr(const char *path, struct stat *stbuf)
+{
+  memset(stbuf, 0, sizeof(*stbuf));
+  if (strcmp(path, STATS_DIR) == 0) {
+    stbuf->st_mode = S_IFDIR | 0555;
+    stbuf->st_nlink = 2;
+  } else if (strcmp(path, STATS_FILE) == 0) {
+    stbuf->st_mode = S_IFREG | 0444;
+    stbuf->st_nlink = 1;
+  } else {
+    return -ENOENT;
+  }
+  stbuf->st_uid = getuid();
+  stbuf->st_gid = getgid();
+  stbuf->st_atime = stbuf->st_mtime = stbuf->st_ctime = mount_time;
+
+  return 0;
+}
+
+/*
+ * Take a snapshot into an anonymous file, which the ordinary read paths
+ * then serve; direct_io since the size in getattr is not known.
+ */
+static int
+stats_open(const char *path, struct fuse_file_info *fi)
+{
+  char buf[STATS_SIZE];
+  struct monfs_file *file;
+  int res, len;
+
+  if (strcmp(path, STATS_FILE) != 0)
+    return (strcmp(path, STATS_DIR) == 0 ? -EISDIR : -ENOENT);
+  if ((fi->flags & O_ACCMODE) != O_RDONLY)
+    return -EACCES;
+
+  len = monfs_monitor_stats(buf, sizeof(buf));
+  if (len >= (int)sizeof(buf))
+    len = sizeof(buf) - 1;
+
+  file = monfs_monitor_file_alloc();
+  if (file == NULL)
+    return -ENOMEM;
+
+  file->ap = NULL;
+  file->fd = memfd_create("monfs-stats", MFD_CLOEXEC);
+  if (file->fd == -1) {
+    res = -errno;
+    monfs_monitor_file_free(file);
+    return res;
+  }
+
+  if (pwrite(file->fd, buf, len, 0) != len || fchmod(file->fd, 0444) == -1) {
+    close(file->fd);
+    monfs_monitor_file_free(file);
+    return -EIO;
+  }
+
+  fi->fh = (uintptr_t) file;
+  fi->direct_io = 1;
+
+  return 0;
 }
 
 /** 
@@ -86,18 +211,21 @@ static int
 monfs_getattr(const char *path, struct stat *stbuf)
 {
   int res;
-  char *monfs_path;
+  const char *monfs_path;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_GETATTR, t1, stats_getattr(path, stbuf));
+
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 	
-  res = lstat(monfs_path, stbuf);
+  res = fstatat(monfs_root_fd, monfs_path, stbuf, AT_SYMLINK_NOFOLLOW);
   if (res == -1) 
     res = -errno;
 
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_GETATTR, t1, res);
 }
 
 /** Read the target of a symbolic link */
@@ -105,13 +233,20 @@ static int
 monfs_readlink(const char *path, char *buf, size_t size)
 {
   int res;
-  char *monfs_path;
+  const char *monfs_path;
+  struct stat st;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path)) {
+    res = stats_getattr(path, &st);
+    return op_done(MONFS_OP_READLINK, t1, res < 0 ? res : -EINVAL);
+  }
+
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 
-  res = readlink(monfs_path, buf, size -1);
+  res = readlinkat(monfs_root_fd, monfs_path, buf, size -1);
   if (res == -1)
     res = -errno;
   else {
@@ -119,29 +254,31 @@ monfs_readlink(const char *path, char *buf, size_t size)
     res = 0;
   }
 
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_READLINK, t1, res);
 }
 
 static int
 monfs_mknod(const char *path, mode_t mode, dev_t rdev)
 {
   int res;
-  char *monfs_path;
+  const char *monfs_path;
+  unsigned long long t1;
+
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_MKNOD, t1, -EROFS);
 
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 
   if (S_ISFIFO(mode))
-    res = mkfifo(monfs_path, mode);
+    res = mkfifoat(monfs_root_fd, monfs_path, mode);
   else
-    res = mknod(monfs_path, mode, rdev);
+    res = mknodat(monfs_root_fd, monfs_path, mode, rdev);
   if (res == -1)
     res = -errno;
 	
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_MKNOD, t1, res);
 }
 
 /** Create a directory */
@@ -149,36 +286,42 @@ static int
 monfs_mkdir(const char *path, mode_t mode)
 {
   int res;
-  char *monfs_path;
+  const char *monfs_path;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_MKDIR, t1, -EROFS);
+
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 	
-  res = mkdir(monfs_path, mode);
+  res = mkdirat(monfs_root_fd, monfs_path, mode);
   if (res == -1)
     res = -errno;
 	
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_MKDIR, t1, res);
 }
 
 /** Remove a file */
 static int 
 monfs_unlink(const char *path) {
   int res;
-  char *monfs_path;
+  const char *monfs_path;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_UNLINK, t1, -EROFS);
+
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 	
-  res = unlink(monfs_path);
+  res = unlinkat(monfs_root_fd, monfs_path, 0);
   if (res == -1)
     res = -errno;
 
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_UNLINK, t1, res);
 }
 
 /** Remove a directory */
@@ -186,82 +329,88 @@ static int
 monfs_rmdir(const char *path)
 {
   int res;
-  char *monfs_path;
+  const char *monfs_path;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_RMDIR, t1, -EROFS);
+
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 
-  res = rmdir(monfs_path);
+  res = unlinkat(monfs_root_fd, monfs_path, AT_REMOVEDIR);
   if (res == -1)
     res = -errno;
 	
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_RMDIR, t1, res);
 }
 /** Create a symbolic link */
 static int
 monfs_symlink(const char *from, const char *to)
 {
   int res;
-  char *monfs_from, *monfs_to;
+  const char *monfs_from, *monfs_to;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(to))
+    return op_done(MONFS_OP_SYMLINK, t1, -EROFS);
+
   monfs_to = get_relative_monfs_path(to);
-  if (monfs_to == NULL)
-    return -ENOMEM;
 	
-  res = symlink(from, monfs_to);
+  res = symlinkat(from, monfs_root_fd, monfs_to);
   if (res == -1)
     res = -errno;
 
-  free(monfs_to);
-  return res;
+  return op_done(MONFS_OP_SYMLINK, t1, res);
 }
 
 /** Rename a file */
 static int
 monfs_rename(const char *from , const char *to) {
   int res;
-  char *monfs_from, *monfs_to;
+  const char *monfs_from, *monfs_to;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(from) || is_stats_path(to))
+    return op_done(MONFS_OP_RENAME, t1, -EROFS);
+
   monfs_from = get_relative_monfs_path(from);
-  if (monfs_from == NULL)
-    return -ENOMEM;
 	
   monfs_to = get_relative_monfs_path(to);
-  if (monfs_to == NULL)
-    return -ENOMEM;
 	
-  res = rename(monfs_from, monfs_to);
+  res = renameat(monfs_root_fd, monfs_from, monfs_root_fd, monfs_to);
   if (res == -1)
     res = -errno;
 	
-  free(monfs_from);
-  free(monfs_to);
-  return res;
+  return op_done(MONFS_OP_RENAME, t1, res);
 }
 
 /** Create a hard link to a file */
 static int
 monfs_link(const char *from, const char *to) {
   int res;
-  char *monfs_from, *monfs_to;
+  const char *monfs_from, *monfs_to;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(from) || is_stats_path(to))
+    return op_done(MONFS_OP_LINK, t1, -EROFS);
+
   monfs_from = get_relative_monfs_path(from);
-  if (monfs_from == NULL)
-    return -ENOMEM;
 	
   monfs_to = get_relative_monfs_path(to);
-  if (monfs_to == NULL)
-    return -ENOMEM;
 	
-  res = link(monfs_from, monfs_to);
+  res = linkat(monfs_root_fd, monfs_from, monfs_root_fd, monfs_to, 0);
   if (res == -1)
     res = -errno;
 	
-  free(monfs_from);
-  free(monfs_to);
-  return res;
+  return op_done(MONFS_OP_LINK, t1, res);
 }
 
 /** Change the permission bits of a file */
@@ -269,18 +418,21 @@ static int
 monfs_chmod(const char *path, mode_t mode)
 {
   int res;
-  char *monfs_path;
+  const char *monfs_path;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_CHMOD, t1, -EROFS);
+
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 	
-  res = chmod(monfs_path, mode);
+  res = fchmodat(monfs_root_fd, monfs_path, mode, 0);
   if (res == -1)
     res = -errno;
 	
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_CHMOD, t1, res);
 }
 
 /** Change the owner and group of a file */
@@ -288,37 +440,50 @@ static int
 monfs_chown(const char *path, uid_t uid, gid_t gid) 
 {
   int res;
-  char *monfs_path;
+  const char *monfs_path;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_CHOWN, t1, -EROFS);
+
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 
-  res = lchown(monfs_path, uid, gid);
+  res = fchownat(monfs_root_fd, monfs_path, uid, gid, AT_SYMLINK_NOFOLLOW);
   if (res == -1) 
     res = -errno;
 
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_CHOWN, t1, res);
 }
 
 /** Change the size of a file */
 static int
 monfs_truncate(const char *path, off_t size)
 {
-  int res;
-  char *monfs_path;
+  int res, fd;
+  const char *monfs_path;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_TRUNCATE, t1, -EROFS);
+
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 	
-  res = truncate(monfs_path, size);
+  /* there is no truncateat() */
+  fd = openat(monfs_root_fd, monfs_path, O_WRONLY | O_NONBLOCK);
+  if (fd == -1)
+    return op_done(MONFS_OP_TRUNCATE, t1, -errno);
+
+  res = ftruncate(fd, size);
   if (res == -1) 
     res = -errno;
+
+  close(fd);
 	
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_TRUNCATE, t1, res);
 }
 
 /** File open operation */
@@ -326,24 +491,33 @@ static int
 monfs_open(const char *path, struct fuse_file_info *fi)
 {
   int res;
-  char *monfs_path;
+  const char *monfs_path;
+  struct monfs_file *file;
+  unsigned long long t1;
     
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_OPEN, t1, stats_open(path, fi));
+
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 
-  res = open(monfs_path, fi->flags);
-  if (res == -1)
+  file = monfs_monitor_file_alloc();
+  if (file == NULL)
+    return op_done(MONFS_OP_OPEN, t1, -ENOMEM);
+
+  res = openat(monfs_root_fd, monfs_path, fi->flags);
+  if (res == -1) {
     res = -errno;
-  else {
-    fi->fh = res;
-    monfs_monitor_open(fuse_get_context()->pid, fi->fh, path);
+    monfs_monitor_file_free(file);
+  } else {
+    file->fd = res;
+    fi->fh = (uintptr_t) file;
+    monfs_monitor_open(fuse_get_context()->pid, file, path);
     res = 0;
   }
 
-  
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_OPEN, t1, res);
 }
 
 /** Read data from an open file */
@@ -353,19 +527,18 @@ monfs_read(const char *path, char *buf, size_t size, off_t offset,
 {
   int res;
   (void) path; 
-  struct timeval t1, t2;
+  struct monfs_file *file = get_file(fi);
+  unsigned long long t1, t2;
 
-  gettimeofday(&t1, NULL);
-  res = pread(fi->fh, buf, size, offset);
-  gettimeofday(&t2, NULL);
+  t1 = monfs_monitor_clock();
+  res = pread(file->fd, buf, size, offset);
+  t2 = monfs_monitor_clock();
   if (res == -1)
     res = -errno;
-  else {
-    timersub(&t2, &t1, &t2);
-    monfs_monitor_read(fi->fh, res, &t2);
-  }
+  else
+    monfs_monitor_read(file, size, res, offset, t2 - t1);
 
-  return res;
+  return op_done(MONFS_OP_READ, t1, res);
 }
 
 /** Write data from an open file */
@@ -375,38 +548,132 @@ monfs_write(const char *path, const char *buf,
 {
   int res;
   (void) path; 
-  struct timeval t1, t2;
+  struct monfs_file *file = get_file(fi);
+  unsigned long long t1, t2;
 
-  gettimeofday(&t1, NULL);
-  res = pwrite(fi->fh, buf, size, offset);
-  gettimeofday(&t2, NULL);
+  t1 = monfs_monitor_clock();
+  res = pwrite(file->fd, buf, size, offset);
+  t2 = monfs_monitor_clock();
   if (res == -1)
     res = -errno;
-  else {
-    timersub(&t2, &t1, &t2);
-    monfs_monitor_write(fi->fh, res, &t2);
-  }
+  else
+    monfs_monitor_write(file, size, res, offset, t2 - t1);
 	
-  return res;
+  return op_done(MONFS_OP_WRITE, t1, res);
+}
+
+#if FUSE_VERSION >= 29
+/**
+ * Read data without copying it through monfs: hand libfuse a buffer
+ * backed by the file descriptor so that it can splice straight from the
+ * backing file to /dev/fuse.  The read itself happens after we return,
+ * so a monitored handle records the requested size, short or not, and
+ * a time that covers only setting up the request.
+ *
+ * With read_copy, a monitored handle is read here with pread into a
+ * memory buffer instead, as in monfs_read, so that the recorded latency
+ * and size are those of the read, at the cost of the copy.  libfuse
+ * frees the buffer after the reply.
+ */
+static int
+monfs_read_buf(const char *path, struct fuse_bufvec **bufp,
+	       size_t size, off_t offset, struct fuse_file_info *fi)
+{
+  struct fuse_bufvec *src;
+  struct monfs_file *file = get_file(fi);
+  unsigned long long t1, t2;
+  ssize_t res;
+  void *mem;
+  (void) path;
+
+  t1 = monfs_monitor_clock();
+
+  src = malloc(sizeof(struct fuse_bufvec));
+  if (src == NULL)
+    return op_done(MONFS_OP_READ, t1, -ENOMEM);
+  *src = FUSE_BUFVEC_INIT(size);
+
+  if (file->ap == NULL || !monfs_monitor_read_copy()) {
+    src->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    src->buf[0].fd = file->fd;
+    src->buf[0].pos = offset;
+    *bufp = src;
+    monfs_monitor_read(file, size, size, offset, monfs_monitor_clock() - t1);
+    return op_done(MONFS_OP_READ, t1, 0);
+  }
+
+  mem = malloc(size);
+  if (mem == NULL) {
+    free(src);
+    return op_done(MONFS_OP_READ, t1, -ENOMEM);
+  }
+
+  t2 = monfs_monitor_clock();
+  res = pread(file->fd, mem, size, offset);
+  if (res == -1) {
+    res = -errno;
+    free(mem);
+    free(src);
+    return op_done(MONFS_OP_READ, t1, res);
+  }
+  monfs_monitor_read(file, size, res, offset, monfs_monitor_clock() - t2);
+
+  src->buf[0].mem = mem;
+  src->buf[0].size = res;
+  *bufp = src;
+
+  return op_done(MONFS_OP_READ, t1, 0);
+}
+
+/** Write data from a buffer libfuse may have spliced from /dev/fuse */
+static int
+monfs_write_buf(const char *path, struct fuse_bufvec *buf,
+		off_t offset, struct fuse_file_info *fi)
+{
+  int res;
+  struct fuse_bufvec dst = FUSE_BUFVEC_INIT(fuse_buf_size(buf));
+  struct monfs_file *file = get_file(fi);
+  unsigned long long t1, t2;
+  (void) path;
+
+  dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+  dst.buf[0].fd = file->fd;
+  dst.buf[0].pos = offset;
+
+  t1 = monfs_monitor_clock();
+  res = fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+  t2 = monfs_monitor_clock();
+  if (res >= 0)
+    monfs_monitor_write(file, fuse_buf_size(buf), res, offset, t2 - t1);
+
+  return op_done(MONFS_OP_WRITE, t1, res);
 }
+#endif
 
 /** Get file system statistics */
 static int
 monfs_statfs(const char* path, struct statvfs *stbuf)
 {
-  int res;
-  char *monfs_path;
+  int res, fd;
+  const char *monfs_path;
+  unsigned long long t1;
 	
-  monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
+  t1 = monfs_monitor_clock();
+
+  /* /.monfs lives in monfs itself; report the backing file system */
+  monfs_path = get_relative_monfs_path(is_stats_path(path) ? "/" : path);
 	
-  res = statvfs(monfs_path, stbuf);
+  fd = openat(monfs_root_fd, monfs_path, O_PATH);
+  if (fd == -1)
+    return op_done(MONFS_OP_STATFS, t1, -errno);
+
+  res = fstatvfs(fd, stbuf);
   if (res == -1)
     res = -errno;
 
-  free(monfs_path);
-  return res;
+  close(fd);
+
+  return op_done(MONFS_OP_STATFS, t1, res);
 }
 
 /** Possibly flush cached data */
@@ -414,25 +681,36 @@ static int
 monfs_flush(const char *path, struct fuse_file_info *fi)
 {
   int res;
+  struct monfs_file *file = get_file(fi);
+  unsigned long long t1;
   (void) path;
 
-  res = close(dup(fi->fh));
+  t1 = monfs_monitor_clock();
+
+  res = close(dup(file->fd));
   if (res == -1)
-    return -errno;
+    return op_done(MONFS_OP_FLUSH, t1, -errno);
+
+  monfs_monitor_sync(file, MONFS_SYNC_FLUSH, monfs_monitor_clock() - t1);
 	
-  return 0;
+  return op_done(MONFS_OP_FLUSH, t1, 0);
 }
 
 /** Release an open file */
 static int
 monfs_release(const char *path, struct fuse_file_info *fi)
 {
+  struct monfs_file *file = get_file(fi);
+  unsigned long long t1;
   (void) path;
 
-  monfs_monitor_close(fi->fh, "localhost");
-  close(fi->fh);
+  t1 = monfs_monitor_clock();
 
-  return 0;
+  monfs_monitor_close(file, "localhost");
+  close(file->fd);
+  monfs_monitor_file_free(file);
+
+  return op_done(MONFS_OP_RELEASE, t1, 0);
 }
 
 /** Synchronize file contents */
@@ -440,22 +718,29 @@ static int
 monfs_fsync(const char *path, int isdatasync,
 	    struct fuse_file_info *fi)
 {
-  int res;
+  int res, kind = MONFS_SYNC_FSYNC;
+  struct monfs_file *file = get_file(fi);
+  unsigned long long t1;
   (void) path;
 
+  t1 = monfs_monitor_clock();
+
 #ifndef HAVE_FDATASYNC
   (void) isdatasync;
 #else
-  if (isdatasync)
-    res = fdatasync(fi->fh);
-  else
+  if (isdatasync) {
+    res = fdatasync(file->fd);
+    kind = MONFS_SYNC_FDATASYNC;
+  } else
 #endif
-    res = fsync(fi->fh);
+    res = fsync(file->fd);
     
   if (res == -1)
-    return -errno;
+    return op_done(MONFS_OP_FSYNC, t1, -errno);
 
-  return res;
+  monfs_monitor_sync(file, kind, monfs_monitor_clock() - t1);
+
+  return op_done(MONFS_OP_FSYNC, t1, res);
 }
 
 #ifdef HAVE_SETXATTR
@@ -465,18 +750,23 @@ monfs_setxattr(const char *path, const char *name, const char *value,
 	       size_t size, int flags)
 {
   int res;
-  char *monfs_path;
-	
-  monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
-	
+  char monfs_path[PATH_MAX];
+  unsigned long long t1;
+
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_SETXATTR, t1, -EROFS);
+
+  res = get_proc_monfs_path(monfs_path, sizeof(monfs_path), path);
+  if (res != 0)
+    return op_done(MONFS_OP_SETXATTR, t1, res);
+
   res = lsetxattr(monfs_path, name, value, size, flags);
   if (res == -1)
     res = -errno;
 		
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_SETXATTR, t1, res);
 }
 
 /** Get extended attributes */
@@ -485,84 +775,109 @@ monfs_getxattr(const char *path, const char *name, char *value,
 	       size_t size) 
 {
   int res;
-  char *monfs_path;
+  char monfs_path[PATH_MAX];
+  struct stat st;
+  unsigned long long t1;
+
+  t1 = monfs_monitor_clock();
+
+  /* /.monfs has no extended attributes */
+  if (is_stats_path(path)) {
+    res = stats_getattr(path, &st);
+    return op_done(MONFS_OP_GETXATTR, t1, res < 0 ? res : -ENODATA);
+  }
+
+  res = get_proc_monfs_path(monfs_path, sizeof(monfs_path), path);
+  if (res != 0)
+    return op_done(MONFS_OP_GETXATTR, t1, res);
 
-  monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
-	
   res = lgetxattr(monfs_path, name, value, size);
   if (res == -1)
     res = -errno;
 	
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_GETXATTR, t1, res);
 }
 
 /** List extended attributes */
 static int
 monfs_listxattr(const char *path, char *list, size_t size) {
   int res;
-  char *monfs_path;
-	
-  monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
+  char monfs_path[PATH_MAX];
+  struct stat st;
+  unsigned long long t1;
+
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_LISTXATTR, t1, stats_getattr(path, &st));
+
+  res = get_proc_monfs_path(monfs_path, sizeof(monfs_path), path);
+  if (res != 0)
+    return op_done(MONFS_OP_LISTXATTR, t1, res);
 
   res = llistxattr(monfs_path, list, size);
   if (res == -1)
     res = -errno;
 	
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_LISTXATTR, t1, res);
 }
 
 /** Remove extended attributes */
 static int
 monfs_removexattr(const char *path, const char *name) {
   int res;
-  char *monfs_path;
+  char monfs_path[PATH_MAX];
+  unsigned long long t1;
+
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_REMOVEXATTR, t1, -EROFS);
+
+  res = get_proc_monfs_path(monfs_path, sizeof(monfs_path), path);
+  if (res != 0)
+    return op_done(MONFS_OP_REMOVEXATTR, t1, res);
 
-  monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
-	
   res = lremovexattr(monfs_path, name); 
   if (res == -1)
     res = -errno;
 	
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_REMOVEXATTR, t1, res);
 }
 #endif /* HAVE_SETXATTR */
 
 /** Open directory */
 static int
 monfs_opendir(const char *path, struct fuse_file_info *fi) {
-  int res;
-  char *monfs_path;
+  int res, fd;
+  const char *monfs_path;
   DIR *dp;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path)) {
+    fi->fh = 0; /* no DIR, see monfs_readdir() */
+    res = (strcmp(path, STATS_DIR) == 0 ? 0 : -ENOTDIR);
+    return op_done(MONFS_OP_OPENDIR, t1, res);
+  }
+
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 	
-  dp = opendir(monfs_path);
+  fd = openat(monfs_root_fd, monfs_path, O_RDONLY | O_DIRECTORY);
+  if (fd == -1)
+    return op_done(MONFS_OP_OPENDIR, t1, -errno);
+
+  dp = fdopendir(fd);
   if (dp == NULL) {
     res = -errno;
+    close(fd);
   } else {
     fi->fh = (unsigned long) dp;
     res = 0;
   }
 
-  free(monfs_path);
-  return res;
-}
-
-static inline DIR *
-get_dirp(struct fuse_file_info *fi)
-{
-  return (DIR *) (uintptr_t) fi->fh;
+  return op_done(MONFS_OP_OPENDIR, t1, res);
 }
 
 /** Read directory */
@@ -570,10 +885,20 @@ static int
 monfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 	      off_t offset, struct fuse_file_info *fi)
 {
-  char *monfs_path;
+  const char *monfs_path;
   DIR *dp = get_dirp(fi);
   struct dirent *de;
+  unsigned long long t1;
 	
+  t1 = monfs_monitor_clock();
+
+  if (dp == NULL) {
+    filler(buf, ".", NULL, 0);
+    filler(buf, "..", NULL, 0);
+    filler(buf, STATS_FILE + sizeof(STATS_DIR), NULL, 0);
+    return op_done(MONFS_OP_READDIR, t1, 0);
+  }
+
   seekdir(dp, offset);
   while ((de = readdir(dp)) != NULL) {
     struct stat st;
@@ -584,7 +909,7 @@ monfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
       break;
   }
 	
-  return 0;
+  return op_done(MONFS_OP_READDIR, t1, 0);
 }
 
 /** Release directory */
@@ -592,16 +917,21 @@ static int
 monfs_releasedir(const char *path, struct fuse_file_info *fi)
 {
   DIR *dp = get_dirp(fi);
+  unsigned long long t1;
   (void) path;
-  closedir(dp);
-  return 0;
+  t1 = monfs_monitor_clock();
+
+  if (dp != NULL)
+    closedir(dp);
+  return op_done(MONFS_OP_RELEASEDIR, t1, 0);
 }
 
 static void*
 monfs_init(struct fuse_conn_info *info)
 {
-  fchdir(monfs_root_fd);
-  close(monfs_root_fd);
+#if FUSE_VERSION >= 29
+  info->want |= info->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE);
+#endif
   monfs_monitor_init(db_filename);
 }
 
@@ -609,6 +939,7 @@ static void
 monfs_destroy(void *private_data) 
 {
   monfs_monitor_destroy();
+  close(monfs_root_fd);
   free(monfs_root);
   free(db_filename);
 }
@@ -617,18 +948,25 @@ monfs_destroy(void *private_data)
 static int
 monfs_access(const char *path, int mask) {
   int res;
-  char *monfs_path;
+  const char *monfs_path;
+  struct stat st;
+  unsigned long long t1;
+
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path)) {
+    if (mask & W_OK)
+      return op_done(MONFS_OP_ACCESS, t1, -EACCES);
+    return op_done(MONFS_OP_ACCESS, t1, stats_getattr(path, &st));
+  }
 
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 
-  res = access(monfs_path, mask);
+  res = faccessat(monfs_root_fd, monfs_path, mask, 0);
   if (res == -1)
     res = -errno;
 
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_ACCESS, t1, res);
 }
 
 /** Create and open a file */
@@ -636,23 +974,33 @@ static int
 monfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
   int res;
-  char *monfs_path;
+  const char *monfs_path;
+  struct monfs_file *file;
+  unsigned long long t1;
+
+  t1 = monfs_monitor_clock();
+
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_CREATE, t1, -EROFS);
 
   monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
 
-  res = open(monfs_path, fi->flags, mode);
-  if (res == -1)
+  file = monfs_monitor_file_alloc();
+  if (file == NULL)
+    return op_done(MONFS_OP_CREATE, t1, -ENOMEM);
+
+  res = openat(monfs_root_fd, monfs_path, fi->flags, mode);
+  if (res == -1) {
     res = -errno;
-  else {
-    fi->fh = res;
-    monfs_monitor_open(fuse_get_context()->pid, fi->fh, path);
+    monfs_monitor_file_free(file);
+  } else {
+    file->fd = res;
+    fi->fh = (uintptr_t) file;
+    monfs_monitor_open(fuse_get_context()->pid, file, path);
     res = 0;
   }
 
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_CREATE, t1, res);
 }
 
 /** Change the size of an open file */
@@ -661,13 +1009,19 @@ monfs_ftruncate(const char *path, off_t size,
 		struct fuse_file_info *fi)
 {
   int res;
+  struct monfs_file *file = get_file(fi);
+  unsigned long long t1;
   (void) path;
 	
-  res = ftruncate(fi->fh, size);
+  t1 = monfs_monitor_clock();
+
+  res = ftruncate(file->fd, size);
   if (res == -1)
-    return -errno;
+    return op_done(MONFS_OP_FTRUNCATE, t1, -errno);
+
+  monfs_monitor_sync(file, MONFS_SYNC_FTRUNCATE, monfs_monitor_clock() - t1);
 	
-  return 0;
+  return op_done(MONFS_OP_FTRUNCATE, t1, 0);
 }
 
 /** Get attributes from an open file */
@@ -676,13 +1030,16 @@ monfs_fgetattr(const char *path, struct stat *stbuf,
 	       struct fuse_file_info *fi)
 {
   int res;
+  unsigned long long t1;
   (void) path;
 	
-  res = fstat(fi->fh, stbuf);
+  t1 = monfs_monitor_clock();
+
+  res = fstat(get_file(fi)->fd, stbuf);
   if (res == -1)
-    return -errno;
+    return op_done(MONFS_OP_FGETATTR, t1, -errno);
 	
-  return 0;
+  return op_done(MONFS_OP_FGETATTR, t1, 0);
 }
 
 #if ULOCKMGR
@@ -691,10 +1048,14 @@ static int
 monfs_lock(const char *path, 
 	   struct fuse_file_info *fi, int cmd, struct flock *lock)
 {
+  unsigned long long t1;
   (void) path;
 
-  return ulockmgr_op(fi->fh, cmd, lock, &fi->lock_owner,
-		     sizeof(fi->lock_owner));
+  t1 = monfs_monitor_clock();
+
+  return op_done(MONFS_OP_LOCK, t1,
+		 ulockmgr_op(get_file(fi)->fd, cmd, lock, &fi->lock_owner,
+			     sizeof(fi->lock_owner)));
 }
 #endif
 
@@ -703,24 +1064,21 @@ static int
 monfs_utimens(const char *path, const struct timespec ts[2]) 
 {
   int res;
-  char *monfs_path;
-  struct timeval tv[2];
+  const char *monfs_path;
+  unsigned long long t1;
 
-  monfs_path = get_relative_monfs_path(path);
-  if (monfs_path == NULL)
-    return -ENOMEM;
+  t1 = monfs_monitor_clock();
 
-  tv[0].tv_sec = ts[0].tv_sec;
-  tv[0].tv_usec = ts[0].tv_nsec / 1000;
-  tv[1].tv_sec = ts[1].tv_sec;
-  tv[1].tv_usec = ts[1].tv_nsec / 1000;
+  if (is_stats_path(path))
+    return op_done(MONFS_OP_UTIMENS, t1, -EROFS);
 
-  res = utimes(monfs_path, tv);
+  monfs_path = get_relative_monfs_path(path);
+
+  res = utimensat(monfs_root_fd, monfs_path, ts, AT_SYMLINK_NOFOLLOW);
   if (res == -1)
     res = -errno;
 
-  free(monfs_path);
-  return res;
+  return op_done(MONFS_OP_UTIMENS, t1, res);
 }
 
 struct 
@@ -740,6 +1098,10 @@ fuse_operations monfs_oper = {
   .open			= monfs_open,
   .read 	        = monfs_read,
   .write		= monfs_write,
+#if FUSE_VERSION >= 29
+  .read_buf		= monfs_read_buf,
+  .write_buf		= monfs_write_buf,
+#endif
   .statfs		= monfs_statfs,
   .flush		= monfs_flush,
   .release 		= monfs_release,
@@ -764,6 +1126,538 @@ fuse_operations monfs_oper = {
 #endif
   .utimens 		= monfs_utimens,
 };
+#endif /* MONFS_NO_MONITOR */
+
+/**
+ * Passthrough operations, for --nomonitor: the same calls on the
+ * backing file system with no clock reads, no monitor hooks and no
+ * /.monfs, as a baseline for what monitoring costs.  fh holds the file
+ * descriptor itself.
+ */
+static inline int
+get_fd(struct fuse_file_info *fi)
+{
+  return (int) fi->fh;
+}
+
+static int
+pt_getattr(const char *path, struct stat *stbuf)
+{
+  if (fstatat(monfs_root_fd, get_relative_monfs_path(path), stbuf,
+	      AT_SYMLINK_NOFOLLOW) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_readlink(const char *path, char *buf, size_t size)
+{
+  int res;
+
+  res = readlinkat(monfs_root_fd, get_relative_monfs_path(path), buf,
+		   size - 1);
+  if (res == -1)
+    return -errno;
+
+  buf[res] = '\0';
+  return 0;
+}
+
+static int
+pt_mknod(const char *path, mode_t mode, dev_t rdev)
+{
+  int res;
+
+  if (S_ISFIFO(mode))
+    res = mkfifoat(monfs_root_fd, get_relative_monfs_path(path), mode);
+  else
+    res = mknodat(monfs_root_fd, get_relative_monfs_path(path), mode, rdev);
+  if (res == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_mkdir(const char *path, mode_t mode)
+{
+  if (mkdirat(monfs_root_fd, get_relative_monfs_path(path), mode) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_unlink(const char *path)
+{
+  if (unlinkat(monfs_root_fd, get_relative_monfs_path(path), 0) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_rmdir(const char *path)
+{
+  if (unlinkat(monfs_root_fd, get_relative_monfs_path(path),
+	       AT_REMOVEDIR) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_symlink(const char *from, const char *to)
+{
+  if (symlinkat(from, monfs_root_fd, get_relative_monfs_path(to)) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_rename(const char *from, const char *to)
+{
+  if (renameat(monfs_root_fd, get_relative_monfs_path(from),
+	       monfs_root_fd, get_relative_monfs_path(to)) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_link(const char *from, const char *to)
+{
+  if (linkat(monfs_root_fd, get_relative_monfs_path(from),
+	     monfs_root_fd, get_relative_monfs_path(to), 0) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_chmod(const char *path, mode_t mode)
+{
+  if (fchmodat(monfs_root_fd, get_relative_monfs_path(path), mode, 0) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_chown(const char *path, uid_t uid, gid_t gid)
+{
+  if (fchownat(monfs_root_fd, get_relative_monfs_path(path), uid, gid,
+	       AT_SYMLINK_NOFOLLOW) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_truncate(const char *path, off_t size)
+{
+  int res, fd;
+
+  fd = openat(monfs_root_fd, get_relative_monfs_path(path),
+	      O_WRONLY | O_NONBLOCK);
+  if (fd == -1)
+    return -errno;
+
+  res = ftruncate(fd, size);
+  if (res == -1)
+    res = -errno;
+
+  close(fd);
+
+  return res;
+}
+
+static int
+pt_open(const char *path, struct fuse_file_info *fi)
+{
+  int fd;
+
+  fd = openat(monfs_root_fd, get_relative_monfs_path(path), fi->flags);
+  if (fd == -1)
+    return -errno;
+
+  fi->fh = fd;
+  return 0;
+}
+
+static int
+pt_read(const char *path, char *buf, size_t size, off_t offset,
+	struct fuse_file_info *fi)
+{
+  int res;
+  (void) path;
+
+  res = pread(get_fd(fi), buf, size, offset);
+  if (res == -1)
+    return -errno;
+
+  return res;
+}
+
+static int
+pt_write(const char *path, const char *buf, size_t size, off_t offset,
+	 struct fuse_file_info *fi)
+{
+  int res;
+  (void) path;
+
+  res = pwrite(get_fd(fi), buf, size, offset);
+  if (res == -1)
+    return -errno;
+
+  return res;
+}
+
+#if FUSE_VERSION >= 29
+static int
+pt_read_buf(const char *path, struct fuse_bufvec **bufp,
+	    size_t size, off_t offset, struct fuse_file_info *fi)
+{
+  struct fuse_bufvec *src;
+  (void) path;
+
+  src = malloc(sizeof(struct fuse_bufvec));
+  if (src == NULL)
+    return -ENOMEM;
+
+  *src = FUSE_BUFVEC_INIT(size);
+  src->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+  src->buf[0].fd = get_fd(fi);
+  src->buf[0].pos = offset;
+  *bufp = src;
+
+  return 0;
+}
+
+static int
+pt_write_buf(const char *path, struct fuse_bufvec *buf,
+	     off_t offset, struct fuse_file_info *fi)
+{
+  struct fuse_bufvec dst = FUSE_BUFVEC_INIT(fuse_buf_size(buf));
+  (void) path;
+
+  dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+  dst.buf[0].fd = get_fd(fi);
+  dst.buf[0].pos = offset;
+
+  return fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+}
+#endif
+
+static int
+pt_statfs(const char *path, struct statvfs *stbuf)
+{
+  int res, fd;
+
+  fd = openat(monfs_root_fd, get_relative_monfs_path(path), O_PATH);
+  if (fd == -1)
+    return -errno;
+
+  res = fstatvfs(fd, stbuf);
+  if (res == -1)
+    res = -errno;
+
+  close(fd);
+
+  return res;
+}
+
+static int
+pt_flush(const char *path, struct fuse_file_info *fi)
+{
+  (void) path;
+
+  if (close(dup(get_fd(fi))) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_release(const char *path, struct fuse_file_info *fi)
+{
+  (void) path;
+
+  close(get_fd(fi));
+  return 0;
+}
+
+static int
+pt_fsync(const char *path, int isdatasync, struct fuse_file_info *fi)
+{
+  int res;
+  (void) path;
+
+#ifndef HAVE_FDATASYNC
+  (void) isdatasync;
+#else
+  if (isdatasync)
+    res = fdatasync(get_fd(fi));
+  else
+#endif
+    res = fsync(get_fd(fi));
+  if (res == -1)
+    return -errno;
+
+  return 0;
+}
+
+#ifdef HAVE_SETXATTR
+static int
+pt_setxattr(const char *path, const char *name, const char *value,
+	    size_t size, int flags)
+{
+  char monfs_path[PATH_MAX];
+  int res;
+
+  res = get_proc_monfs_path(monfs_path, sizeof(monfs_path), path);
+  if (res != 0)
+    return res;
+
+  if (lsetxattr(monfs_path, name, value, size, flags) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_getxattr(const char *path, const char *name, char *value, size_t size)
+{
+  char monfs_path[PATH_MAX];
+  int res;
+
+  res = get_proc_monfs_path(monfs_path, sizeof(monfs_path), path);
+  if (res != 0)
+    return res;
+
+  res = lgetxattr(monfs_path, name, value, size);
+  if (res == -1)
+    return -errno;
+
+  return res;
+}
+
+static int
+pt_listxattr(const char *path, char *list, size_t size)
+{
+  char monfs_path[PATH_MAX];
+  int res;
+
+  res = get_proc_monfs_path(monfs_path, sizeof(monfs_path), path);
+  if (res != 0)
+    return res;
+
+  res = llistxattr(monfs_path, list, size);
+  if (res == -1)
+    return -errno;
+
+  return res;
+}
+
+static int
+pt_removexattr(const char *path, const char *name)
+{
+  char monfs_path[PATH_MAX];
+  int res;
+
+  res = get_proc_monfs_path(monfs_path, sizeof(monfs_path), path);
+  if (res != 0)
+    return res;
+
+  if (lremovexattr(monfs_path, name) == -1)
+    return -errno;
+
+  return 0;
+}
+#endif /* HAVE_SETXATTR */
+
+static int
+pt_opendir(const char *path, struct fuse_file_info *fi)
+{
+  int res, fd;
+  DIR *dp;
+
+  fd = openat(monfs_root_fd, get_relative_monfs_path(path),
+	      O_RDONLY | O_DIRECTORY);
+  if (fd == -1)
+    return -errno;
+
+  dp = fdopendir(fd);
+  if (dp == NULL) {
+    res = -errno;
+    close(fd);
+    return res;
+  }
+
+  fi->fh = (unsigned long) dp;
+  return 0;
+}
+
+static int
+pt_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+	   off_t offset, struct fuse_file_info *fi)
+{
+  DIR *dp = get_dirp(fi);
+  struct dirent *de;
+  (void) path;
+
+  seekdir(dp, offset);
+  while ((de = readdir(dp)) != NULL) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_ino = de->d_ino;
+    st.st_mode = de->d_type << 12;
+    if (filler(buf, de->d_name, &st, telldir(dp)))
+      break;
+  }
+
+  return 0;
+}
+
+static int
+pt_releasedir(const char *path, struct fuse_file_info *fi)
+{
+  (void) path;
+
+  closedir(get_dirp(fi));
+  return 0;
+}
+
+static void *
+pt_init(struct fuse_conn_info *info)
+{
+#if FUSE_VERSION >= 29
+  info->want |= info->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE);
+#endif
+  return NULL;
+}
+
+static void
+pt_destroy(void *private_data)
+{
+  close(monfs_root_fd);
+  free(monfs_root);
+  free(db_filename);
+}
+
+static int
+pt_access(const char *path, int mask)
+{
+  if (faccessat(monfs_root_fd, get_relative_monfs_path(path), mask, 0) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+  int fd;
+
+  fd = openat(monfs_root_fd, get_relative_monfs_path(path), fi->flags, mode);
+  if (fd == -1)
+    return -errno;
+
+  fi->fh = fd;
+  return 0;
+}
+
+static int
+pt_ftruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+  (void) path;
+
+  if (ftruncate(get_fd(fi), size) == -1)
+    return -errno;
+
+  return 0;
+}
+
+static int
+pt_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+  (void) path;
+
+  if (fstat(get_fd(fi), stbuf) == -1)
+    return -errno;
+
+  return 0;
+}
+
+#ifdef ULOCKMGR
+static int
+pt_lock(const char *path, struct fuse_file_info *fi, int cmd,
+	struct flock *lock)
+{
+  (void) path;
+
+  return ulockmgr_op(get_fd(fi), cmd, lock, &fi->lock_owner,
+		     sizeof(fi->lock_owner));
+}
+#endif
+
+static int
+pt_utimens(const char *path, const struct timespec ts[2])
+{
+  if (utimensat(monfs_root_fd, get_relative_monfs_path(path), ts,
+		AT_SYMLINK_NOFOLLOW) == -1)
+    return -errno;
+
+  return 0;
+}
+
+struct
+fuse_operations passthrough_oper = {
+  .getattr 		= pt_getattr,
+  .readlink		= pt_readlink,
+  .mkdir        	= pt_mkdir,
+  .mknod		= pt_mknod,
+  .unlink		= pt_unlink,
+  .rmdir		= pt_rmdir,
+  .symlink		= pt_symlink,
+  .rename		= pt_rename,
+  .link			= pt_link,
+  .chmod		= pt_chmod,
+  .chown		= pt_chown,
+  .truncate		= pt_truncate,
+  .open			= pt_open,
+  .read 	        = pt_read,
+  .write		= pt_write,
+#if FUSE_VERSION >= 29
+  .read_buf		= pt_read_buf,
+  .write_buf		= pt_write_buf,
+#endif
+  .statfs		= pt_statfs,
+  .flush		= pt_flush,
+  .release 		= pt_release,
+  .fsync		= pt_fsync,
+#ifdef HAVE_SETXATTR
+  .setxattr		= pt_setxattr,
+  .getxattr		= pt_getxattr,
+  .listxattr		= pt_listxattr,
+  .removexattr 	= pt_removexattr,
+#endif
+  .opendir		= pt_opendir,
+  .readdir 		= pt_readdir,
+  .releasedir 	= pt_releasedir,
+  .init			= pt_init,
+  .destroy		= pt_destroy,
+  .access 		= pt_access,
+  .create 		= pt_create,
+  .ftruncate		= pt_ftruncate,
+  .fgetattr		= pt_fgetattr,
+#ifdef ULOCKMGR
+  .lock			= pt_lock,
+#endif
+  .utimens 		= pt_utimens,
+};
 
 /**
  * Main Routine
@@ -778,10 +1672,35 @@ usage()
   fprintf(stderr,
 	  "Usage: %s [MonFS options] <mountpoint> [FUSE options]\n"
 	  "\n"
-	  "	MonFS options is not implemented yet."
+	  "MonFS options:\n"
+	  "    --nomonitor            disable monitoring\n"
+	  "    --config PATH          settings and filters (default: /etc/monfs.conf)\n"
+	  "    --db PATH              logger output (default: /tmp/monfs.db)\n"
+#ifndef MONFS_NO_MONITOR
+	  "    --logger NAME          sqlite, file (line protocol) or null (default: sqlite)\n"
+	  "    --batch-size N         max profiles per logger transaction (default: 1024)\n"
+	  "    --batch-time MSEC      max time per logger transaction (default: 100)\n"
+	  "    --queue-size N         max profiles waiting for the logger (default: 65536)\n"
+	  "    --queue-memory MB      also keep them within MB, 0 for no limit (default: 0)\n"
+	  "    --queue-overflow WHAT  block, drop or fold when the queue is full (default: drop)\n"
+	  "    --queue-sampling       queue fewer profiles while the queue stays deep\n"
+	  "    --caller-ttl MSEC      trust cached caller paths this long (default: 1000)\n"
+	  "    --defer-caller         resolve uncached callers in the logger thread\n"
+	  "    --tsc                  time I/O with the calibrated TSC if invariant\n"
+	  "    --trace PATH           record every read and write to an event trace\n"
+	  "    --trace-size MB        size of the trace ring (default: 1024)\n"
+	  "    --op-stats SEC         log operation counts every SEC, 0 disables (default: 10)\n"
+	  "    --op-stats-callers     also count operations per pid\n"
+	  "    --rotate SEC           start a new sqlite segment every SEC, 0 disables (default: 0)\n"
+	  "    --rotate-size MB       or once the segment reaches MB, 0 disables (default: 0)\n"
+	  "    --retention HOURS      delete segments older than HOURS, 0 keeps them (default: 0)\n"
+	  "    --db-staging WHAT      off, wal or memory: trade durability for commits (default: off)\n"
+	  "    --db-backup SEC        flush a memory staged db to disk every SEC (default: 10)\n"
+	  "    --read-copy            read monitored files through monfs to time each read\n"
+#endif
 	  "\n", program_name);
 	
-  fuse_main(2, (char **) fusehelp, &monfs_oper, NULL);
+  fuse_main(2, (char **) fusehelp, &passthrough_oper, NULL);
 }
 
 static int
@@ -813,6 +1732,7 @@ static void
 parse_long_option(int *argcp, char ***argvp)
 {
   char **argv = *argvp;
+  char *val;
 	
   if (strcmp(&argv[0][1], "-nomonitor") == 0) {
     monitor_flag = 0;
@@ -827,6 +1747,114 @@ parse_long_option(int *argcp, char ***argvp)
       }
     }
 
+  } else if (strcmp(&argv[0][1], "-config") == 0) {
+    next_arg_set(&val, argcp, argvp, 1); /* already read, see read_config() */
+#ifndef MONFS_NO_MONITOR
+  } else if (strcmp(&argv[0][1], "-logger") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("logger", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-batch-size") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("log_batch_size", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-batch-time") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("log_batch_time", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-queue-size") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("queue_size", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-queue-memory") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("queue_memory", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-queue-overflow") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("queue_overflow", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-queue-sampling") == 0) {
+    monfs_monitor_set_config("queue_sampling", "1");
+  } else if (strcmp(&argv[0][1], "-caller-ttl") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("caller_cache_ttl", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-defer-caller") == 0) {
+    monfs_monitor_set_config("caller_defer", "1");
+  } else if (strcmp(&argv[0][1], "-read-copy") == 0) {
+    monfs_monitor_set_config("read_copy", "1");
+  } else if (strcmp(&argv[0][1], "-tsc") == 0) {
+    monfs_monitor_set_config("clock_tsc", "1");
+  } else if (strcmp(&argv[0][1], "-trace") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (!is_absolute_path(val)) {
+      usage();
+      exit(1);
+    }
+    if (monfs_monitor_set_config("trace_path", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-trace-size") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("trace_size", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-op-stats") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("op_stats_interval", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-op-stats-callers") == 0) {
+    monfs_monitor_set_config("op_stats_callers", "1");
+  } else if (strcmp(&argv[0][1], "-rotate") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("db_rotate", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-rotate-size") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("db_rotate_size", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-retention") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("db_retention", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-db-staging") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("db_staging", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+  } else if (strcmp(&argv[0][1], "-db-backup") == 0) {
+    next_arg_set(&val, argcp, argvp, 1);
+    if (monfs_monitor_set_config("db_backup_interval", val) != MONFS_OK) {
+      usage();
+      exit(1);
+    }
+#endif
   } else {
     usage();
     exit(1);
@@ -878,29 +1906,70 @@ check_monfs_options(int *argcp, char ***argvp)
   *argvp = argv;
 }
 
+#ifndef MONFS_NO_MONITOR
+/*
+ * The config file goes first so that the options override it.  Not
+ * even read with --nomonitor, which leaves the monitor untouched.
+ */
+static void
+read_config(int argc, char **argv)
+{
+  const char *filename = NULL;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--nomonitor") == 0)
+      return;
+    if (strcmp(argv[i], "--config") == 0 && i < argc - 1)
+      filename = argv[i + 1];
+  }
+
+  if (monfs_monitor_read_config(filename) != MONFS_OK)
+    exit(1);
+}
+#endif
+
 static void
 set_monfs_options()
 {
   fprintf(stdout, "monfs root : %s\n", monfs_root);
-  fprintf(stdout, "monfs db : %s\n", db_filename);
+#ifndef MONFS_NO_MONITOR
+  if (monitor_flag) {
+    fprintf(stdout, "monfs db : %s\n", db_filename);
+    mount_time = time(NULL);
+  }
+#endif
 
-  chdir(monfs_root);
-  monfs_root_fd = open(".", 0);	
+  /* opened before mounting, monfs may be mounted on top of its root */
+  monfs_root_fd = open(monfs_root, O_RDONLY | O_DIRECTORY);
+  if (monfs_root_fd == -1) {
+    perror(monfs_root);
+    exit(1);
+  }
 }
 
 int
 main(int argc, char *argv[])
 {
   int res;
+  struct fuse_operations *oper = &passthrough_oper;
 
   if (argc > 0)
     program_name = basename(argv[0]);
 
+#ifndef MONFS_NO_MONITOR
+  read_config(argc, argv);
+#endif
   check_monfs_options(&argc, &argv);
   set_monfs_options();
 
+#ifndef MONFS_NO_MONITOR
+  if (monitor_flag)
+    oper = &monfs_oper;
+#endif
+
   umask(0);
-  res = fuse_main(argc, argv, &monfs_oper, NULL);
+  res = fuse_main(argc, argv, oper, NULL);
 
   return (res);
 }
@@ -0,0 +1,162 @@
+
+/** This file is part of MonFS. **
+ * 
+ * MonFS: File system for monitoring file I/O operations
+ * 
+ * Copyright (C) 2010 Hitoshi Sato <hitoshi.sato@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * This program can be distributed under the terms of the GNU GPL.
+ * See the file COPYING.
+ */
+
+/*
+ * monfs_trace: print the events of a monfs event trace (--trace) as
+ * text, one line per event:
+ *
+ *   <time> <tid> <op> <handle> <offset> <size> <latency nsec> [<pid>]
+ *
+ * <time> is seconds since the epoch; with -m it is the raw monotonic
+ * time stamp in nsec instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <monfs_trace.h>
+
+static char *program_name = "monfs_trace";
+
+static const char *op_names[] = {
+  [MONFS_TRACE_NONE] = "none",
+  [MONFS_TRACE_OPEN] = "open",
+  [MONFS_TRACE_READ] = "read",
+  [MONFS_TRACE_WRITE] = "write",
+  [MONFS_TRACE_CLOSE] = "close",
+  [MONFS_TRACE_FSYNC] = "fsync",
+  [MONFS_TRACE_FDATASYNC] = "fdatasync",
+  [MONFS_TRACE_FLUSH] = "flush",
+  [MONFS_TRACE_FTRUNCATE] = "ftruncate",
+};
+
+static void
+usage()
+{
+  fprintf(stderr, "usage: %s [-m] trace_file\n", program_name);
+}
+
+static void
+print_event(const struct monfs_trace_event *e, int64_t realtime_offset,
+	    int monotonic)
+{
+  uint64_t t;
+
+  if (monotonic) {
+    printf("%" PRIu64, e->time_ns);
+  } else {
+    t = e->time_ns + realtime_offset;
+    printf("%" PRIu64 ".%09" PRIu64, t / 1000000000, t % 1000000000);
+  }
+
+  printf(" %" PRIu32 " %s %#" PRIx64 " %" PRId64 " %" PRIu32 " %" PRIu64,
+	 e->tid, e->op < MONFS_TRACE_OPS ? op_names[e->op] : "?",
+	 e->handle, e->offset, e->size, e->latency_ns);
+  if (e->op == MONFS_TRACE_OPEN)
+    printf(" %" PRIu32, e->pid);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, opt, monotonic = 0;
+  struct stat st;
+  const struct monfs_trace_header *h;
+  const struct monfs_trace_event *e;
+  const char *events;
+  uint64_t i, first, slots;
+  char *map;
+
+  if (argc > 0)
+    program_name = basename(argv[0]);
+
+  while ((opt = getopt(argc, argv, "m")) != -1) {
+    switch (opt) {
+    case 'm':
+      monotonic = 1;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage();
+    return 1;
+  }
+
+  fd = open(argv[optind], O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (st.st_size < MONFS_TRACE_HEADER_SIZE) {
+    fprintf(stderr, "%s: not a monfs trace\n", argv[optind]);
+    return 1;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  h = (const struct monfs_trace_header *)map;
+  if (memcmp(h->magic, MONFS_TRACE_MAGIC, sizeof(h->magic)) != 0 ||
+      h->version != MONFS_TRACE_VERSION ||
+      h->event_size != sizeof(struct monfs_trace_event) ||
+      h->capacity == 0) {
+    fprintf(stderr, "%s: not a monfs trace, or another version\n",
+	    argv[optind]);
+    return 1;
+  }
+
+  /* only the segments that made it to the file */
+  events = map + MONFS_TRACE_HEADER_SIZE;
+  slots = (st.st_size - MONFS_TRACE_HEADER_SIZE) / h->event_size;
+  if (slots > h->capacity)
+    slots = h->capacity;
+
+  first = h->written > h->capacity ? h->written - h->capacity : 0;
+  for (i = first; i < h->written; i++) {
+    if (i % h->capacity >= slots)
+      continue;
+    e = (const struct monfs_trace_event *)
+      (events + (i % h->capacity) * h->event_size);
+    if (e->op == MONFS_TRACE_NONE)
+      continue;
+    print_event(e, h->realtime_offset, monotonic);
+  }
+
+  munmap(map, st.st_size);
+  close(fd);
+
+  return 0;
+}